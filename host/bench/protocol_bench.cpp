@@ -0,0 +1,267 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file protocol_bench.cpp
+ * @brief Host benchmark of the DeviceProtocol.h decoder
+ *
+ * @details Decodes a large device output stream with DeviceDecoder, fed in chunks
+ * of different sizes as they come from a serial port, and reports the decoded
+ * messages per second and the bytes copied into the carry buffer. Every chunk size
+ * must decode the same messages. The stream is read from a file captured from the
+ * device, or generated: bare and stamped reports with command replies and a
+ * capture of 16 frames every 10000 messages. A line parser building a std::string
+ * per line and converting it with strtoul, as consumers write it, runs on the
+ * same stream for comparison (it skips the frames).
+ *
+ * Usage: protocol_bench [--messages N] [--file stream.bin] [--repeat N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "DeviceProtocol.h"
+
+static volatile uint64_t sink = 0; ///< Keeps results alive
+
+// Function to append a string to the stream
+static void append(std::vector<uint8_t> &stream, const char *text)
+{
+    stream.insert(stream.end(), text, text + strlen(text));
+}
+
+// Function to generate a device output stream
+static void generate(std::vector<uint8_t> &stream, uint32_t messages)
+{
+    char line[64];
+    uint32_t seed = 1;
+    uint16_t value = 512;
+    uint16_t seq = 0;
+    uint32_t time = 0;
+    append(stream, "w");
+    for (uint32_t i = 0; i < messages; ++i)
+    {
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        value = (uint16_t)((value + (seed % 9) - 4) & 0x3FF);
+        time += 5000;
+        if (i % 10000 == 9999)
+        {
+            // Capture of 16 blocks of 32 samples and the end frame
+            append(stream, "c7211,5565\n");
+            for (uint8_t block = 0; block < 16; ++block)
+            {
+                stream.push_back(DEVICE_FRAME_SYNC);
+                stream.push_back(block);
+                stream.push_back(64);
+                for (uint8_t s = 0; s < 32; ++s)
+                {
+                    stream.push_back((uint8_t)value);
+                    stream.push_back((uint8_t)(value >> 8));
+                }
+            }
+            stream.insert(stream.end(), {DEVICE_FRAME_SYNC, 16, 0});
+            continue;
+        }
+        if (i % 1000 == 500)
+            snprintf(line, sizeof(line), "p%u,%u,%u\n", i % 100, time, time + 40);
+        else if (i % 1000 == 900)
+            snprintf(line, sizeof(line), "m%u,%u,%u,%u,1\n", 900, 920, 1100, 2000);
+        else if ((i / 50000) % 2)
+            snprintf(line, sizeof(line), "%u,%u,%u\n", value, seq++, time);
+        else
+            snprintf(line, sizeof(line), "%u\n", value);
+        append(stream, line);
+    }
+}
+
+/**
+ * @brief Counts of one decode, every chunk size must match
+ */
+struct Result
+{
+    uint64_t messages; ///< Messages
+    uint64_t reports; ///< Reports
+    uint64_t frames; ///< Frames
+    uint64_t value_sum; ///< Sum of the report values
+    uint64_t copied; ///< Bytes copied into the carry buffer
+    double seconds; ///< Run time
+};
+
+// Function to decode the stream in chunks
+static Result decode(const std::vector<uint8_t> &stream, size_t chunk, uint32_t repeat)
+{
+    Result r = {};
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < repeat; ++i)
+    {
+        DeviceDecoder decoder;
+        uint64_t value_sum = 0;
+        for (size_t offset = 0; offset < stream.size(); offset += chunk)
+        {
+            size_t length = std::min(chunk, stream.size() - offset);
+            decoder.feed(stream.data() + offset, length, [&value_sum](const DeviceMessage &m) {
+                if (m.kind == DEVICE_REPORT)
+                    value_sum += m.values[0];
+            });
+        }
+        r.messages = decoder.stats().messages;
+        r.reports = decoder.stats().reports;
+        r.frames = decoder.stats().frames;
+        r.copied = decoder.stats().copied;
+        r.value_sum = value_sum;
+    }
+    auto end = std::chrono::steady_clock::now();
+    r.seconds = std::chrono::duration<double>(end - begin).count() / repeat;
+    return r;
+}
+
+// Function to decode the stream with a std::string line parser
+static Result decode_naive(const std::vector<uint8_t> &stream, uint32_t repeat)
+{
+    Result r = {};
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < repeat; ++i)
+    {
+        std::string line;
+        uint64_t messages = 0, reports = 0, value_sum = 0;
+        size_t skip = 0;
+        for (size_t p = 0; p < stream.size(); ++p)
+        {
+            uint8_t c = stream[p];
+            if (skip)
+            {
+                skip--;
+                continue;
+            }
+            if (line.empty() && c == DEVICE_FRAME_SYNC && p + 2 < stream.size())
+            {
+                // Frame, skip sequence number, length and payload
+                skip = 2 + stream[p + 2];
+                messages++;
+                continue;
+            }
+            if (line.empty() && c == 'w')
+            {
+                messages++;
+                continue;
+            }
+            if (c != '\n')
+            {
+                line += (char)c;
+                continue;
+            }
+            messages++;
+            if (!line.empty() && line[0] >= '0' && line[0] <= '9')
+            {
+                reports++;
+                value_sum += strtoul(line.c_str(), NULL, 10);
+            }
+            line.clear();
+        }
+        r.messages = messages;
+        r.reports = reports;
+        r.value_sum = value_sum;
+    }
+    auto end = std::chrono::steady_clock::now();
+    r.seconds = std::chrono::duration<double>(end - begin).count() / repeat;
+    return r;
+}
+
+// Function to print one result
+static void print_result(const char *name, const Result &r, size_t bytes)
+{
+    printf("%-24s %8.2f Mmsg/s %8.1f MB/s %10llu copied\n", name, r.messages / r.seconds / 1e6,
+           bytes / r.seconds / 1e6, (unsigned long long)r.copied);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t messages = 2000000;
+    uint32_t repeat = 5;
+    const char *path = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--messages") == 0 && i + 1 < argc)
+            messages = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            repeat = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else
+        {
+            fprintf(stderr, "usage: %s [--messages N] [--file stream.bin] [--repeat N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (repeat == 0)
+        repeat = 1;
+
+    std::vector<uint8_t> stream;
+    if (path)
+    {
+        FILE *in = fopen(path, "rb");
+        if (!in)
+        {
+            fprintf(stderr, "protocol_bench: cannot read %s\n", path);
+            return 1;
+        }
+        uint8_t buffer[4096];
+        size_t length;
+        while ((length = fread(buffer, 1, sizeof(buffer), in)) > 0)
+            stream.insert(stream.end(), buffer, buffer + length);
+        fclose(in);
+    }
+    else
+    {
+        generate(stream, messages);
+    }
+
+    Result whole = decode(stream, stream.size(), repeat);
+    printf("stream %zu bytes, %llu messages, %llu reports, %llu frames\n", stream.size(),
+           (unsigned long long)whole.messages, (unsigned long long)whole.reports, (unsigned long long)whole.frames);
+    print_result("decoder, whole stream", whole, stream.size());
+
+    char failed = 0;
+    static const size_t chunks[] = {1, 7, 64, 4096};
+    for (size_t chunk : chunks)
+    {
+        Result r = decode(stream, chunk, repeat);
+        char name[32];
+        snprintf(name, sizeof(name), "decoder, %zu B chunks", chunk);
+        print_result(name, r, stream.size());
+        if (r.messages != whole.messages || r.reports != whole.reports || r.frames != whole.frames ||
+            r.value_sum != whole.value_sum)
+        {
+            fprintf(stderr, "protocol_bench: %zu B chunks decode differently\n", chunk);
+            failed = 1;
+        }
+    }
+
+    Result naive = decode_naive(stream, repeat);
+    print_result("std::string + strtoul", naive, stream.size());
+    printf("%-24s %8.2fx\n", "speedup", naive.seconds / whole.seconds);
+    sink = naive.value_sum + whole.value_sum;
+    return failed;
+}
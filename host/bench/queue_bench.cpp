@@ -0,0 +1,136 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file queue_bench.cpp
+ * @brief Host benchmark of the TQueue iterator algorithms
+ *
+ * @details Compares the function pointer algorithms (queue_for_each,
+ * queue_find_if, queue_find_if_not) with the templated span algorithms
+ * (queue_for_each_value, queue_find_if_value, queue_find_if_not_value) on a
+ * full queue that wraps around the end of the ring, so both spans are used.
+ *
+ * Usage: queue_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "TQueue.h"
+
+static uint32_t sum = 0; ///< Accumulator of the for_each callback
+static volatile uint32_t sink = 0; ///< Keeps results alive
+
+// Callback for queue_for_each
+static void add_value(const struct TQueueIterator *aIter)
+{
+    sum += queue_iterator_value(aIter);
+}
+
+// Predicate for queue_find_if, never true so the whole queue is scanned
+static char is_marker(const struct TQueueIterator *aIter)
+{
+    return queue_iterator_value(aIter) == 0xFF;
+}
+
+// Predicate for queue_find_if_not, always true so the whole queue is scanned
+static char is_data(const struct TQueueIterator *aIter)
+{
+    return queue_iterator_value(aIter) != 0xFF;
+}
+
+/**
+ * @brief Function to time a benchmark body
+ *
+ * @param name Name of the benchmark
+ * @param iterations Number of runs
+ * @param elements Number of elements visited per run
+ * @param body Benchmark body
+ * @return double Nanoseconds per element
+ */
+template <typename TBody>
+static double run(const char *name, uint32_t iterations, size_t elements, TBody body)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; ++i)
+        body();
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / ((double)iterations * elements);
+    printf("%-28s %8.3f ns/element\n", name, ns);
+    return ns;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : 200000;
+
+    // Move the indexes to the middle of the ring, then fill the queue, so it wraps around
+    struct TQueue queue;
+    queue_init(&queue);
+    for (int i = 0; i < QUEUE_MAXCOUNT / 2; ++i)
+    {
+        queue_push(&queue, 0);
+        queue_pop(&queue);
+    }
+    size_t count = 0;
+    while (queue_push(&queue, (TQueueElement)(count % 200)))
+        count++;
+
+    struct TQueueIterator begin = queue_iterator_begin(&queue);
+
+    double callback = run("queue_for_each", iterations, count, [&] {
+        sum = 0;
+        queue_for_each(begin, add_value);
+        sink = sum;
+    });
+    double templated = run("queue_for_each_value", iterations, count, [&] {
+        uint32_t local = 0;
+        queue_for_each_value(begin, [&local](TQueueElement &aValue) { local += aValue; });
+        sink = local;
+    });
+    printf("%-28s %8.2fx\n", "speedup", callback / templated);
+
+    callback = run("queue_find_if", iterations, count, [&] {
+        sink = queue_find_if(begin, is_marker).iPos;
+    });
+    templated = run("queue_find_if_value", iterations, count, [&] {
+        sink = queue_find_if_value(begin, [](TQueueElement aValue) { return aValue == 0xFF; }).iPos;
+    });
+    printf("%-28s %8.2fx\n", "speedup", callback / templated);
+
+    callback = run("queue_find_if_not", iterations, count, [&] {
+        sink = queue_find_if_not(begin, is_data).iPos;
+    });
+    templated = run("queue_find_if_not_value", iterations, count, [&] {
+        sink = queue_find_if_not_value(begin, [](TQueueElement aValue) { return aValue != 0xFF; }).iPos;
+    });
+    printf("%-28s %8.2fx\n", "speedup", callback / templated);
+
+    // Both variants must agree
+    uint32_t expected = 0;
+    queue_for_each_value(begin, [&expected](TQueueElement &aValue) { expected += aValue; });
+    sum = 0;
+    queue_for_each(begin, add_value);
+    if (sum != expected)
+    {
+        fprintf(stderr, "queue_bench: results differ (%u != %u)\n", sum, expected);
+        return 1;
+    }
+    return 0;
+}
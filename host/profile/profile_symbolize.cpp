@@ -0,0 +1,292 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file profile_symbolize.cpp
+ * @brief Host symbolizer of the sampling profiler reports
+ *
+ * @details Reads the output of the 'h' command of a firmware built with FEATURE_PROFILING
+ * (any other lines of a captured session are skipped, the last complete report is
+ * used) and resolves the histogram bins against the function symbols of the ELF
+ * file, listed with avr-nm. A bin shared by several functions splits its samples
+ * by the number of bytes each function covers in the bin, such shares are marked
+ * as estimated. A report over a smaller range ("h<from>,<to>") gives smaller bins
+ * and exact shares.
+ *
+ * Usage: profile_symbolize --elf firmware.elf | --symbols nm.txt [--nm avr-nm] [--bins] [report.txt]
+ *
+ * nm.txt is the output of "avr-nm -n -S -C --defined-only firmware.elf". Without a
+ * report file the report is read from stdin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define DATA_OFFSET 0x800000UL // avr-nm address offset of the RAM symbols
+#define LINE_MAX_LENGTH 1024 // Longest accepted input line
+
+/**
+ * @brief Function symbol in flash
+ */
+struct Symbol
+{
+    uint32_t address; ///< Byte address
+    uint32_t size; ///< Size in bytes, up to the next symbol when nm has none
+    std::string name; ///< Demangled name
+    double samples; ///< Samples attributed to the function
+    char estimated; ///< Some samples come from a bin shared with other code
+};
+
+/**
+ * @brief Profiler report
+ */
+struct Report
+{
+    uint32_t from = 0; ///< First byte address of the range
+    uint32_t to = 0; ///< Byte address after the range
+    uint32_t bin_size = 0; ///< Bytes per bin
+    uint32_t samples = 0; ///< All samples
+    uint32_t outside = 0; ///< Samples outside the range
+    uint32_t running = 0; ///< 0 if a full bin stopped the profiler
+    std::vector<std::pair<uint32_t, uint32_t>> bins; ///< Bin index and samples
+};
+
+// Function to read the function symbols from avr-nm output
+static char load_symbols(FILE *in, std::vector<Symbol> &symbols)
+{
+    char line[LINE_MAX_LENGTH];
+    while (fgets(line, sizeof(line), in))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *p = line;
+        uint32_t address = (uint32_t)strtoul(p, &p, 16);
+        if (p == line || *p != ' ')
+            continue;
+        // Optional size field
+        char *q = p + 1;
+        uint32_t size = (uint32_t)strtoul(q, &q, 16);
+        if (q - p == 9 && *q == ' ' && q[1] && q[2] == ' ')
+            p = q;
+        else
+            size = 0;
+        char type = p[1];
+        if (!type || p[2] != ' ')
+            continue;
+        // Only code symbols in flash
+        if (!strchr("tTwW", type) || address >= DATA_OFFSET)
+            continue;
+        symbols.push_back(Symbol{address, size, p + 3, 0.0, 0});
+    }
+    if (symbols.empty())
+        return 0;
+
+    std::stable_sort(symbols.begin(), symbols.end(),
+                     [](const Symbol &a, const Symbol &b) { return a.address < b.address; });
+    for (size_t i = 0; i < symbols.size(); ++i)
+    {
+        if (symbols[i].size == 0 && i + 1 < symbols.size())
+            symbols[i].size = symbols[i + 1].address - symbols[i].address;
+    }
+    return 1;
+}
+
+// Function to read the last complete report
+static char load_report(FILE *in, Report &report)
+{
+    char line[LINE_MAX_LENGTH];
+    Report current;
+    char in_report = 0;
+    char found = 0;
+    while (fgets(line, sizeof(line), in))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        // Captured sessions may prefix every line, e.g. with the replay sample and time
+        char *h = strstr(line, "h");
+        while (h && h != line && h[-1] != ' ')
+            h = strstr(h + 1, "h");
+        if (!h)
+            continue;
+        if (strcmp(h, "he") == 0 && in_report)
+        {
+            report = current;
+            in_report = 0;
+            found = 1;
+        }
+        else if (h[1] == 'b' && in_report)
+        {
+            unsigned bin = 0, count = 0;
+            if (sscanf(h, "hb%u,%u", &bin, &count) == 2)
+                current.bins.push_back({bin, count});
+        }
+        else
+        {
+            Report header;
+            if (sscanf(h, "h%u,%u,%u,%u,%u,%u", &header.from, &header.to, &header.bin_size, &header.samples,
+                       &header.outside, &header.running) == 6)
+            {
+                current = header;
+                in_report = 1;
+            }
+        }
+    }
+    return found;
+}
+
+// Function to print a share of the samples
+static void print_share(double samples, uint32_t total)
+{
+    printf("%10.1f %6.2f%%", samples, total ? 100.0 * samples / total : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *elf_path = NULL;
+    const char *symbols_path = NULL;
+    const char *report_path = NULL;
+    const char *nm = "avr-nm";
+    char show_bins = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--elf") == 0 && i + 1 < argc)
+            elf_path = argv[++i];
+        else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc)
+            symbols_path = argv[++i];
+        else if (strcmp(argv[i], "--nm") == 0 && i + 1 < argc)
+            nm = argv[++i];
+        else if (strcmp(argv[i], "--bins") == 0)
+            show_bins = 1;
+        else if (argv[i][0] != '-' && !report_path)
+            report_path = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s --elf firmware.elf | --symbols nm.txt [--nm avr-nm] [--bins] [report.txt]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!elf_path == !symbols_path)
+    {
+        fprintf(stderr, "profile_symbolize: give either --elf or --symbols\n");
+        return 2;
+    }
+
+    std::vector<Symbol> symbols;
+    char loaded;
+    if (elf_path)
+    {
+        std::string command = std::string(nm) + " -n -S -C --defined-only '" + elf_path + "'";
+        FILE *in = popen(command.c_str(), "r");
+        loaded = in && load_symbols(in, symbols);
+        if (in)
+            pclose(in);
+    }
+    else
+    {
+        FILE *in = fopen(symbols_path, "r");
+        loaded = in && load_symbols(in, symbols);
+        if (in)
+            fclose(in);
+    }
+    if (!loaded)
+    {
+        fprintf(stderr, "profile_symbolize: no function symbols found\n");
+        return 1;
+    }
+
+    Report report;
+    FILE *in = report_path ? fopen(report_path, "r") : stdin;
+    if (!in || !load_report(in, report) || report.bin_size == 0)
+    {
+        fprintf(stderr, "profile_symbolize: no complete profiler report found\n");
+        return 1;
+    }
+    if (report_path)
+        fclose(in);
+
+    printf("# range 0x%04x-0x%04x, %u bytes per bin, %u samples, %u outside (%.2f%%)%s\n", report.from, report.to,
+           report.bin_size, report.samples, report.outside,
+           report.samples ? 100.0 * report.outside / report.samples : 0.0,
+           report.running ? "" : ", stopped by a full bin");
+
+    // Split every bin over the functions it covers
+    double unknown = 0.0;
+    for (const auto &bin : report.bins)
+    {
+        uint32_t start = report.from + bin.first * report.bin_size;
+        uint32_t end = std::min(start + report.bin_size, report.to);
+        uint32_t covered = 0;
+        std::string names;
+        for (Symbol &s : symbols)
+        {
+            uint32_t from = std::max(start, s.address);
+            uint32_t to = std::min(end, s.address + s.size);
+            if (from >= to)
+                continue;
+            double share = (double)bin.second * (to - from) / (end - start);
+            s.samples += share;
+            if (to - from != end - start)
+                s.estimated = 1;
+            covered += to - from;
+            if (!names.empty())
+                names += ", ";
+            names += s.name;
+        }
+        if (covered < end - start)
+        {
+            unknown += (double)bin.second * (end - start - covered) / (end - start);
+            if (!names.empty())
+                names += ", ";
+            names += "?";
+        }
+        if (show_bins)
+        {
+            printf("bin 0x%04x-0x%04x ", start, end);
+            print_share(bin.second, report.samples);
+            printf("  %s\n", names.c_str());
+        }
+    }
+
+    std::vector<const Symbol *> hot;
+    for (const Symbol &s : symbols)
+    {
+        if (s.samples > 0.0)
+            hot.push_back(&s);
+    }
+    std::stable_sort(hot.begin(), hot.end(), [](const Symbol *a, const Symbol *b) { return a->samples > b->samples; });
+    printf("#   samples  share  address  function\n");
+    for (const Symbol *s : hot)
+    {
+        print_share(s->samples, report.samples);
+        printf("  0x%04x  %s%s\n", s->address, s->name.c_str(), s->estimated ? " (estimated)" : "");
+    }
+    if (unknown > 0.0)
+    {
+        print_share(unknown, report.samples);
+        printf("          ? (no symbol)\n");
+    }
+    if (report.outside)
+    {
+        print_share(report.outside, report.samples);
+        printf("          outside the range\n");
+    }
+    return 0;
+}
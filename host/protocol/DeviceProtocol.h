@@ -0,0 +1,535 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file DeviceProtocol.h
+ * @brief Header-only host decoder of the device output and encoder of the host commands
+ *
+ * @details DeviceDecoder parses the byte stream of the device incrementally from
+ * buffers owned by the caller and calls a handler for every complete message. It
+ * never allocates: a message that lies completely in the fed buffer is passed as a
+ * view into that buffer, only a message split across two feed() calls is copied
+ * into a fixed carry buffer of the decoder. A view is valid until the handler
+ * returns.
+ *
+ * The stream is ASCII by default: lines ending with '\n' (reports, command replies)
+ * and the single 'w' handshake reply. The framed format
+ *
+ * | 0xA5 | sequence number | payload length | payload |
+ *
+ * is used by the capture mode, the decoder switches to it after the "c" reply and
+ * back to ASCII after a frame with zero payload length. setFramed() switches the
+ * format directly for streams captured in the middle of a capture.
+ *
+ * The device stops the host with XOFF (0x13) when its receive queue fills up and
+ * restarts it with XON (0x11). The flow bytes can appear anywhere outside of the
+ * frames, also inside a line; the decoder removes them and isStopped() tells
+ * whether the host may send. The frames carry binary samples, so the flow control
+ * must be left to the decoder and not to the IXON option of the serial port.
+ *
+ * Usage:
+ * @code
+ * DeviceDecoder decoder;
+ * uint8_t command[DEVICE_COMMAND_MAX];
+ * write(fd, command, device_handshake(command, sizeof(command)));
+ * decoder.feed(buffer, length, [](const DeviceMessage &m) {
+ *     if (m.kind == DEVICE_REPORT)
+ *         set_volume(m.values[0]);
+ * });
+ * if (!decoder.isStopped())
+ *     write(fd, command, device_display(command, sizeof(command), 42));
+ * @endcode
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DEVICE_LINE_MAX 64 // Longest accepted line without the '\n'
+#define DEVICE_FIELDS_MAX 6 // Most decimal fields of one line
+#define DEVICE_FRAME_SYNC 0xA5 // First byte of a frame
+#define DEVICE_XON 0x11 // Flow byte, the host may send again
+#define DEVICE_XOFF 0x13 // Flow byte, the host must stop sending
+#define DEVICE_COMMAND_MAX 8 // Buffer size that fits every encoded command
+
+/**
+ * @brief Kinds of device messages
+ */
+enum DeviceMessageKind : uint8_t
+{
+    DEVICE_HANDSHAKE, ///< 'w' reply, or "v<curve>" with the curve in values[0]
+    DEVICE_REPORT, ///< "<value>" or "<value>,<sequence>,<time>"
+    DEVICE_REPLY, ///< Other command reply, tag is the command letter
+    DEVICE_FRAME, ///< Frame, payload in text, sequence number in sequence
+    DEVICE_END_FRAME, ///< Frame with zero payload length, the end of a capture
+    DEVICE_INVALID ///< Line that is neither a report nor a reply, or an overlong line
+};
+
+/**
+ * @brief Decoded device message
+ */
+struct DeviceMessage
+{
+    DeviceMessageKind kind; ///< Kind of the message
+    char tag; ///< Command letter of a reply, 0 otherwise
+    char subtag; ///< Second letter of a reply ("hb", "he"), 0 otherwise
+    uint8_t sequence; ///< Sequence number of a frame
+    uint8_t count; ///< Number of decimal fields
+    uint32_t values[DEVICE_FIELDS_MAX]; ///< Decimal fields, comma separated
+    const uint8_t *text; ///< Line without '\n' or frame payload, a view valid in the handler
+    uint16_t length; ///< Length of text
+    const uint8_t *token; ///< Ping token, a view into text
+    uint8_t token_length; ///< Length of the ping token
+};
+
+/**
+ * @brief Counters of a decoder
+ */
+struct DeviceDecoderStats
+{
+    uint64_t bytes; ///< Fed bytes
+    uint64_t messages; ///< Decoded messages of every kind
+    uint64_t reports; ///< Reports
+    uint64_t frames; ///< Frames including end frames
+    uint64_t errors; ///< Invalid lines, overlong lines and bytes skipped to find a frame sync
+    uint64_t copied; ///< Bytes copied into the carry buffer
+    uint64_t flow; ///< XON and XOFF bytes
+};
+
+/**
+ * @brief Incremental decoder of the device output
+ */
+class DeviceDecoder
+{
+    enum State : uint8_t
+    {
+        LINE, ///< ASCII line
+        DISCARD, ///< Rest of an overlong line
+        FRAME_SYNC, ///< Waiting for a frame sync
+        FRAME_SEQUENCE, ///< Frame sequence number
+        FRAME_LENGTH, ///< Frame payload length
+        FRAME_PAYLOAD ///< Frame payload
+    };
+
+    State state = LINE;
+    uint8_t frame_sequence = 0;
+    uint8_t frame_length = 0;
+    uint16_t carry_length = 0; ///< Bytes of the current message in carry
+    char stopped = 0; ///< XOFF received and XON not yet
+    uint8_t carry[256]; ///< Message split across two feed() calls, fits a full frame
+    DeviceDecoderStats counters = {};
+
+    // Function to find the line end or the first flow byte, nullptr if there is none
+    static const uint8_t *lineStop(const uint8_t *p, const uint8_t *end)
+    {
+        for (; p < end; ++p)
+        {
+            if (*p == '\n' || *p == DEVICE_XON || *p == DEVICE_XOFF)
+                return p;
+        }
+        return nullptr;
+    }
+
+    // Function to follow a flow byte
+    void flow(uint8_t data)
+    {
+        stopped = data == DEVICE_XOFF;
+        counters.flow++;
+    }
+
+    // Function to parse a decimal number, returns the position after it
+    static const uint8_t *parseNumber(const uint8_t *p, const uint8_t *end, uint32_t &value)
+    {
+        value = 0;
+        while (p < end && *p >= '0' && *p <= '9')
+            value = value * 10 + (*p++ - '0');
+        return p;
+    }
+
+    // Function to parse the comma separated decimal fields of a line
+    static char parseFields(const uint8_t *p, const uint8_t *end, DeviceMessage &m)
+    {
+        while (p < end)
+        {
+            if (m.count == DEVICE_FIELDS_MAX || *p < '0' || *p > '9')
+                return 0;
+            p = parseNumber(p, end, m.values[m.count++]);
+            if (p < end && *p++ != ',')
+                return 0;
+            if (p == end && p[-1] == ',')
+                return 0;
+        }
+        return 1;
+    }
+
+    // Function to decode one complete line
+    template <class Handler>
+    void line(const uint8_t *text, size_t length, Handler &handler)
+    {
+        DeviceMessage m = {};
+        m.text = text;
+        m.length = (uint16_t)length;
+        const uint8_t *end = text + length;
+        if (length && text[0] >= '0' && text[0] <= '9')
+        {
+            m.kind = DEVICE_REPORT;
+            if (!parseFields(text, end, m) || (m.count != 1 && m.count != 3))
+                m.kind = DEVICE_INVALID;
+        }
+        else if (length && text[0] >= 'a' && text[0] <= 'z')
+        {
+            m.kind = (text[0] == 'v') ? DEVICE_HANDSHAKE : DEVICE_REPLY;
+            m.tag = (char)text[0];
+            const uint8_t *p = text + 1;
+            if (m.tag == 'p')
+            {
+                // Ping, the token up to the first comma is not a number
+                m.token = p;
+                while (p < end && *p != ',')
+                    p++;
+                m.token_length = (uint8_t)(p - m.token);
+                if (p < end)
+                    p++;
+            }
+            else if (p < end && *p >= 'a' && *p <= 'z')
+            {
+                m.subtag = (char)*p++;
+            }
+            if (!parseFields(p, end, m))
+                m.kind = DEVICE_INVALID;
+        }
+        else
+        {
+            m.kind = DEVICE_INVALID;
+        }
+        emit(m, handler);
+        // The capture reply is followed by frames
+        if (m.kind == DEVICE_REPLY && m.tag == 'c')
+            state = FRAME_SYNC;
+    }
+
+    // Function to decode one complete frame
+    template <class Handler>
+    void frame(const uint8_t *payload, Handler &handler)
+    {
+        DeviceMessage m = {};
+        m.kind = frame_length ? DEVICE_FRAME : DEVICE_END_FRAME;
+        m.sequence = frame_sequence;
+        m.text = payload;
+        m.length = frame_length;
+        counters.frames++;
+        state = frame_length ? FRAME_SYNC : LINE;
+        emit(m, handler);
+    }
+
+    // Function to count and pass a message to the handler
+    template <class Handler>
+    void emit(const DeviceMessage &m, Handler &handler)
+    {
+        counters.messages++;
+        if (m.kind == DEVICE_REPORT)
+            counters.reports++;
+        else if (m.kind == DEVICE_INVALID)
+            counters.errors++;
+        handler(m);
+    }
+
+    // Function to append bytes of a split message to the carry buffer
+    void keep(const uint8_t *data, size_t length)
+    {
+        memcpy(carry + carry_length, data, length);
+        carry_length += (uint16_t)length;
+        counters.copied += length;
+    }
+
+public:
+    /**
+     * @brief Function to decode a chunk of the device output
+     *
+     * @param data Received bytes, owned by the caller
+     * @param length Number of received bytes
+     * @param handler Callable with a const DeviceMessage &, called for every complete message
+     * @return size_t Number of messages passed to the handler
+     */
+    template <class Handler>
+    size_t feed(const uint8_t *data, size_t length, Handler &&handler)
+    {
+        uint64_t before = counters.messages;
+        const uint8_t *p = data;
+        const uint8_t *end = data + length;
+        counters.bytes += length;
+        while (p < end)
+        {
+            switch (state)
+            {
+            case LINE:
+            {
+                if (carry_length == 0 && *p == 'w')
+                {
+                    // The handshake reply has no line end
+                    DeviceMessage m = {};
+                    m.kind = DEVICE_HANDSHAKE;
+                    m.tag = 'w';
+                    m.text = p;
+                    m.length = 1;
+                    p++;
+                    emit(m, handler);
+                    break;
+                }
+                const uint8_t *newline = lineStop(p, end);
+                const uint8_t *stop = newline ? newline : end;
+                size_t part = stop - p;
+                if (carry_length + part > DEVICE_LINE_MAX)
+                {
+                    DeviceMessage m = {};
+                    m.kind = DEVICE_INVALID;
+                    carry_length = 0;
+                    state = DISCARD;
+                    emit(m, handler);
+                    break;
+                }
+                if (!newline)
+                {
+                    keep(p, part);
+                    p = end;
+                    break;
+                }
+                if (*newline != '\n')
+                {
+                    // The line continues after the flow byte
+                    keep(p, part);
+                    flow(*newline);
+                    p = newline + 1;
+                    break;
+                }
+                if (carry_length)
+                {
+                    keep(p, part);
+                    size_t total = carry_length;
+                    carry_length = 0;
+                    line(carry, total, handler);
+                }
+                else
+                {
+                    line(p, part, handler);
+                }
+                p = newline + 1;
+                break;
+            }
+            case DISCARD:
+            {
+                const uint8_t *newline = lineStop(p, end);
+                p = newline ? newline + 1 : end;
+                if (newline && *newline != '\n')
+                    flow(*newline);
+                else if (newline)
+                    state = LINE;
+                break;
+            }
+            case FRAME_SYNC:
+                if (*p == DEVICE_XON || *p == DEVICE_XOFF)
+                    flow(*p);
+                else if (*p == DEVICE_FRAME_SYNC)
+                    state = FRAME_SEQUENCE;
+                else
+                    counters.errors++;
+                p++;
+                break;
+            case FRAME_SEQUENCE:
+                frame_sequence = *p++;
+                state = FRAME_LENGTH;
+                break;
+            case FRAME_LENGTH:
+                frame_length = *p++;
+                if (frame_length == 0)
+                {
+                    frame(p, handler);
+                    break;
+                }
+                state = FRAME_PAYLOAD;
+                break;
+            case FRAME_PAYLOAD:
+            {
+                size_t missing = frame_length - carry_length;
+                if ((size_t)(end - p) < missing)
+                {
+                    keep(p, end - p);
+                    p = end;
+                }
+                else if (carry_length)
+                {
+                    keep(p, missing);
+                    p += missing;
+                    carry_length = 0;
+                    frame(carry, handler);
+                }
+                else
+                {
+                    frame(p, handler);
+                    p += missing;
+                }
+                break;
+            }
+            }
+        }
+        return (size_t)(counters.messages - before);
+    }
+
+    /**
+     * @brief Function to select the stream format
+     *
+     * @param framed 1 for frames, 0 for ASCII lines
+     */
+    void setFramed(char framed)
+    {
+        state = framed ? FRAME_SYNC : LINE;
+        carry_length = 0;
+    }
+
+    /**
+     * @brief Function to check if the decoder expects frames
+     *
+     * @return char 1 for frames, 0 for ASCII lines
+     */
+    char isFramed() const
+    {
+        return state >= FRAME_SYNC;
+    }
+
+    /**
+     * @brief Function to check if the device stopped the host
+     *
+     * @return char 1 after XOFF until XON, the host must not send meanwhile
+     */
+    char isStopped() const
+    {
+        return stopped;
+    }
+
+    /**
+     * @brief Function to drop a partial message, e.g. after a device reset
+     *
+     * @details A reset device starts with an empty receive queue, so the host is
+     * no longer stopped.
+     */
+    void reset()
+    {
+        state = LINE;
+        carry_length = 0;
+        stopped = 0;
+    }
+
+    /**
+     * @brief Function to get the counters
+     *
+     * @return const DeviceDecoderStats& Counters since construction
+     */
+    const DeviceDecoderStats &stats() const
+    {
+        return counters;
+    }
+};
+
+// Function to copy a command into the caller buffer
+static inline size_t device_command(uint8_t *out, size_t size, const char *command)
+{
+    size_t length = strlen(command);
+    if (length > size)
+        return 0;
+    memcpy(out, command, length);
+    return length;
+}
+
+/**
+ * @brief Function to encode the handshake
+ *
+ * @param out Buffer of at least DEVICE_COMMAND_MAX bytes
+ * @param size Size of the buffer
+ * @param curve Volume curve (0 linear, 1 log, 2 custom), -1 for raw values
+ * @return size_t Number of bytes to send, 0 if the buffer is too small
+ */
+static inline size_t device_handshake(uint8_t *out, size_t size, int curve = -1)
+{
+    if (curve < 0)
+        return device_command(out, size, "w");
+    char command[] = {'v', (char)('0' + curve), '\0'};
+    return device_command(out, size, command);
+}
+
+/**
+ * @brief Function to encode the reset command
+ *
+ * @details The device resets through the watchdog and waits for a new handshake,
+ * reset() the decoder after sending it.
+ *
+ * @param out Buffer of at least DEVICE_COMMAND_MAX bytes
+ * @param size Size of the buffer
+ * @return size_t Number of bytes to send, 0 if the buffer is too small
+ */
+static inline size_t device_reset(uint8_t *out, size_t size)
+{
+    return device_command(out, size, "r");
+}
+
+/**
+ * @brief Function to encode the resume command
+ *
+ * @details The device replies "s1" followed by a report of the current value and
+ * keeps its filter and display, or "s0" when it waits for a handshake. The byte
+ * is accepted in any parser state, also inside a capture; reset() the decoder
+ * after sending it.
+ *
+ * @param out Buffer of at least DEVICE_COMMAND_MAX bytes
+ * @param size Size of the buffer
+ * @return size_t Number of bytes to send, 0 if the buffer is too small
+ */
+static inline size_t device_resume(uint8_t *out, size_t size)
+{
+    return device_command(out, size, "\x18");
+}
+
+/**
+ * @brief Function to encode a value for the display
+ *
+ * @param out Buffer of at least DEVICE_COMMAND_MAX bytes
+ * @param size Size of the buffer
+ * @param value Value from 0 to 999
+ * @return size_t Number of bytes to send, 0 if the buffer is too small or the value too large
+ */
+static inline size_t device_display(uint8_t *out, size_t size, uint16_t value)
+{
+    char command[5];
+    uint8_t length = 0;
+    if (value > 999)
+        return 0;
+    char digits[3];
+    uint8_t count = 0;
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (count)
+        command[length++] = digits[--count];
+    command[length++] = '\n';
+    command[length] = '\0';
+    return device_command(out, size, command);
+}
@@ -0,0 +1,493 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file pty_device.cpp
+ * @brief Pseudo-terminal device emulator for load-testing the host application
+ *
+ * @details The emulator links the unmodified firmware sources against the stubbed
+ * register layer in host/stub, like the replay harness, but runs them in real time
+ * behind a pseudo-terminal. The host application opens the printed PTY path as if
+ * it were the serial port of the board and talks the exact device protocol
+ * (handshake, reports, display lines, mute, reset and the other commands).
+ *
+ * - the knob is a synthetic waveform sampled through ADC_vect() at the firmware
+ *   sampling period or at a fixed rate given by --rate
+ * - host bytes are delivered through USART_RX_vect() at the line rate
+ * - transmitted bytes are paced at the line rate, --baud 0 removes the limit
+ * - the XON/XOFF flow bytes of the firmware are passed to the host application,
+ *   which has to stop sending after XOFF like in front of the board
+ * - SIGUSR1 or --mute-every presses the mute button
+ *
+ * The firmware reports a value at most once per ADC sample, so the sample rate
+ * together with a moving knob sets the report rate.
+ *
+ * Usage: pty_device [--link path] [--knob still|ramp|sine|square|noise] [--knob-hz F]
+ *                   [--min N] [--max N] [--noise N] [--seed N] [--rate HZ] [--baud N]
+ *                   [--mute-every MS] [--stats S]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+#include <string>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "Firmware.h"
+
+ISR(ADC_vect);
+ISR(INT0_vect);
+
+#define WATCHDOG_RESET_US 15000 // Time from wdt_enable() to the restart
+#define RX_CHUNK 256 // Bytes read from the PTY at once
+#define MAX_WAIT_US 10000 // Longest sleep while nothing is due
+
+/**
+ * @brief Shape of the synthetic knob input
+ */
+enum KnobShape
+{
+    KNOB_STILL, ///< Constant at the minimum
+    KNOB_RAMP, ///< Sawtooth from the minimum to the maximum
+    KNOB_SINE, ///< Sine between the minimum and the maximum
+    KNOB_SQUARE, ///< Jumps between the minimum and the maximum
+    KNOB_NOISE ///< Constant in the middle, only the noise moves it
+};
+
+static KnobShape knob = KNOB_SINE; ///< Knob shape
+static double knob_hz = 0.5; ///< Knob frequency
+static int knob_min = 0; ///< Lowest knob value
+static int knob_max = 1023; ///< Highest knob value
+static int knob_noise = 0; ///< Amplitude of the uniform noise in LSB
+static uint32_t noise_state = 1; ///< Noise generator state
+
+static int master_fd = -1; ///< PTY master
+static uint32_t byte_us = 0; ///< Duration of one byte on the line, 0 for no limit
+static uint64_t start_us = 0; ///< Real time of the start
+static uint64_t tx_free_us = 0; ///< Virtual time when the transmitter accepts the next byte
+static std::string tx_pending; ///< Transmitted bytes not yet written to the PTY
+static std::string tx_line; ///< Partially transmitted message
+static std::string rx_pending; ///< Received bytes not yet delivered
+
+// Statistics
+static uint64_t samples = 0;
+static uint64_t late_samples = 0;
+static uint64_t reports = 0;
+static uint64_t tx_bytes = 0;
+static uint64_t tx_dropped = 0;
+static uint64_t rx_bytes = 0;
+static uint32_t rx_overflows = 0;
+static uint32_t resets = 0;
+
+static volatile sig_atomic_t mute_requests = 0;
+static volatile sig_atomic_t stop = 0;
+
+// Function to read the monotonic clock in microseconds
+static uint64_t real_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Function to calculate the current Timer0 compare period in microseconds
+static uint32_t timer0_period_us()
+{
+    uint32_t prescaler = host_timer_prescaler(TCCR0B);
+    if (prescaler == 0)
+        return 0;
+    return (uint32_t)((uint64_t)(OCR0A + 1) * prescaler * 1000000UL / FOSC);
+}
+
+// Function to draw uniform noise in the range <-knob_noise, knob_noise>
+static int next_noise()
+{
+    if (knob_noise == 0)
+        return 0;
+    // xorshift32
+    noise_state ^= noise_state << 13;
+    noise_state ^= noise_state >> 17;
+    noise_state ^= noise_state << 5;
+    return (int)(noise_state % (2 * knob_noise + 1)) - knob_noise;
+}
+
+// Function to evaluate the knob at the given virtual time
+static uint16_t knob_value(uint64_t time_us)
+{
+    double phase = fmod(time_us / 1000000.0 * knob_hz, 1.0);
+    double span = knob_max - knob_min;
+    double value;
+    switch (knob)
+    {
+    case KNOB_RAMP:
+        value = knob_min + span * phase;
+        break;
+    case KNOB_SINE:
+        value = knob_min + span * (0.5 - 0.5 * cos(2.0 * M_PI * phase));
+        break;
+    case KNOB_SQUARE:
+        value = phase < 0.5 ? knob_min : knob_max;
+        break;
+    case KNOB_NOISE:
+        value = knob_min + span / 2;
+        break;
+    default:
+        value = knob_min;
+        break;
+    }
+    int sample = (int)lround(value) + next_noise();
+    return (uint16_t)(sample < 0 ? 0 : (sample > 1023 ? 1023 : sample));
+}
+
+// TX hook, models the USART transmit time and counts the reports
+static void on_tx(uint8_t data)
+{
+    // sendChar busy waits until the previous byte has been shifted out
+    if (host_time_us < tx_free_us)
+        host_time_us = tx_free_us;
+    tx_free_us = host_time_us + byte_us;
+    host_timer1_sync();
+    tx_bytes++;
+    tx_pending += (char)data;
+
+    if (Features::flow_control && (data == FLOW_XON || data == FLOW_XOFF) && !Serial::flow_hold)
+        return;
+    if (data == '\n')
+    {
+        if (!tx_line.empty() && tx_line.find_first_not_of("0123456789,") == std::string::npos)
+            reports++;
+        tx_line.clear();
+    }
+    else
+    {
+        tx_line += (char)data;
+    }
+}
+
+// Function to write the transmitted bytes to the PTY
+static void flush_tx()
+{
+    while (!tx_pending.empty())
+    {
+        ssize_t n = write(master_fd, tx_pending.data(), tx_pending.size());
+        if (n > 0)
+        {
+            tx_pending.erase(0, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        // Nobody reads the port, the bytes are lost like on a real line
+        tx_dropped += tx_pending.size();
+        tx_pending.clear();
+    }
+}
+
+// Function to read the bytes written by the host application
+static void read_rx()
+{
+    char buffer[RX_CHUNK];
+    ssize_t n = read(master_fd, buffer, sizeof(buffer));
+    if (n > 0)
+    {
+        rx_pending.append(buffer, (size_t)n);
+        rx_bytes += (uint64_t)n;
+    }
+}
+
+// Function to run the UDRE interrupt when it is enabled
+static void deliver_udre()
+{
+    if constexpr (Features::flow_control)
+    {
+        if (host_sreg_i && (UCSR0B & (1 << UDRIE0)))
+            USART_UDRE_vect();
+    }
+}
+
+// Function to deliver one received byte through the RX interrupt
+static void deliver_rx(uint8_t data)
+{
+    if (!(UCSR0B & (1 << RXCIE0)))
+        return;
+    if ((Serial::ser_buf.iPushPos + 1) % QUEUE_MAXCOUNT == Serial::ser_buf.iPopPos)
+        rx_overflows++;
+    host_rx_data = data;
+    USART_RX_vect();
+    deliver_udre();
+}
+
+// Function to deliver one knob sample through the ADC interrupt
+static void deliver_sample()
+{
+    samples++;
+    if (host_adc_triggered())
+    {
+        ADC = knob_value(host_time_us);
+        ADC_vect();
+    }
+}
+
+// Function to start the firmware with a fresh Timer1
+static void start_firmware()
+{
+    host_timer1_start();
+    firmware_init();
+}
+
+// Function to restart the firmware after a watchdog reset
+static void reboot()
+{
+    resets++;
+    host_time_us += WATCHDOG_RESET_US;
+    host_reset_registers();
+    // The old median filter array is leaked, the real MCU simply loses its RAM
+    new (&serial) Serial(SERIAL_BAUDRATE, MEDIAN_FILTER_SIZE, SENDING_BIAS, DOUBLE_SPEED);
+    new (&capture) AdcCapture();
+    start_firmware();
+}
+
+// Function to print the statistics to stderr
+static void print_stats()
+{
+    double seconds = host_time_us / 1000000.0;
+    fprintf(stderr, "# time %.1f s, samples %llu (late %llu), reports %llu (%.1f/s), "
+                    "tx %llu B (%.1f B/s, dropped %llu), rx %llu B, rx overflows %u, resets %u\n",
+            seconds, (unsigned long long)samples, (unsigned long long)late_samples,
+            (unsigned long long)reports, seconds > 0 ? reports / seconds : 0.0,
+            (unsigned long long)tx_bytes, seconds > 0 ? tx_bytes / seconds : 0.0,
+            (unsigned long long)tx_dropped, (unsigned long long)rx_bytes, rx_overflows, resets);
+}
+
+static void on_signal(int sig)
+{
+    if (sig == SIGUSR1)
+        mute_requests++;
+    else
+        stop = 1;
+}
+
+// Function to open the PTY and set its slave side to raw mode
+static int open_pty(const char *link_path)
+{
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) < 0 || unlockpt(master_fd) < 0)
+    {
+        perror("pty_device: posix_openpt");
+        return -1;
+    }
+    const char *slave_path = ptsname(master_fd);
+    // Keep the slave open, so the master does not fail while no client is connected
+    int slave_fd = open(slave_path, O_RDWR | O_NOCTTY);
+    if (slave_fd < 0)
+    {
+        perror("pty_device: open slave");
+        return -1;
+    }
+    struct termios tio;
+    tcgetattr(slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave_fd, TCSANOW, &tio);
+    fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+
+    if (link_path)
+    {
+        unlink(link_path);
+        if (symlink(slave_path, link_path) < 0)
+        {
+            perror("pty_device: symlink");
+            return -1;
+        }
+    }
+    printf("%s\n", link_path ? link_path : slave_path);
+    fflush(stdout);
+    return slave_fd;
+}
+
+// Function to parse the knob shape
+static char parse_knob(const char *name)
+{
+    static const char *const names[] = {"still", "ramp", "sine", "square", "noise"};
+    for (int i = 0; i < 5; ++i)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            knob = (KnobShape)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *link_path = NULL;
+    double rate = 0;
+    uint32_t baud = LINE_BAUDRATE;
+    uint32_t mute_every_ms = 0;
+    uint32_t stats_s = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        char has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--link") == 0 && has_value)
+            link_path = argv[++i];
+        else if (strcmp(argv[i], "--knob") == 0 && has_value && parse_knob(argv[i + 1]))
+            i++;
+        else if (strcmp(argv[i], "--knob-hz") == 0 && has_value)
+            knob_hz = atof(argv[++i]);
+        else if (strcmp(argv[i], "--min") == 0 && has_value)
+            knob_min = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max") == 0 && has_value)
+            knob_max = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--noise") == 0 && has_value)
+            knob_noise = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && has_value)
+            noise_state = (uint32_t)strtoul(argv[++i], NULL, 10) | 1;
+        else if (strcmp(argv[i], "--rate") == 0 && has_value)
+            rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--baud") == 0 && has_value)
+            baud = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--mute-every") == 0 && has_value)
+            mute_every_ms = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--stats") == 0 && has_value)
+            stats_s = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else
+        {
+            fprintf(stderr, "usage: %s [--link path] [--knob still|ramp|sine|square|noise] [--knob-hz F]\n"
+                            "       [--min N] [--max N] [--noise N] [--seed N] [--rate HZ] [--baud N]\n"
+                            "       [--mute-every MS] [--stats S]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (open_pty(link_path) < 0)
+        return 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // 8N1, ten bits per byte
+    byte_us = baud ? (uint32_t)((10ULL * 1000000ULL + baud - 1) / baud) : 0;
+    host_tx_hook = on_tx;
+    start_us = real_us();
+    start_firmware();
+
+    uint64_t next_sample_us = host_time_us;
+    uint64_t next_rx_us = 0;
+    uint64_t next_mute_us = mute_every_ms ? mute_every_ms * 1000ULL : UINT64_MAX;
+    uint64_t next_stats_us = stats_s ? stats_s * 1000000ULL : UINT64_MAX;
+    while (!stop)
+    {
+        // Virtual time never falls behind the real time, and when the firmware
+        // ran ahead (blocking delays, transmit time) the loop waits for it
+        uint64_t now = real_us() - start_us;
+        uint64_t period = rate > 0 ? (uint64_t)(1000000.0 / rate) : timer0_period_us();
+        if (period == 0)
+            period = 1000;
+        uint64_t due = next_sample_us;
+        if (!rx_pending.empty() && next_rx_us < due)
+            due = next_rx_us;
+        if (host_time_us > now)
+            due = host_time_us;
+        if (due > now)
+        {
+            uint64_t wait = due - now;
+            struct pollfd pfd = {master_fd, POLLIN, 0};
+            poll(&pfd, 1, (int)((wait < MAX_WAIT_US ? wait : MAX_WAIT_US) / 1000));
+            now = real_us() - start_us;
+        }
+        if (host_time_us < now)
+            host_time_us = now;
+        read_rx();
+
+        if (mute_requests > 0 || host_time_us >= next_mute_us)
+        {
+            if (mute_requests > 0)
+                mute_requests--;
+            else
+                next_mute_us += mute_every_ms * 1000ULL;
+            if (host_sreg_i && (EIMSK & (1 << INT0)))
+                INT0_vect();
+        }
+        if (!rx_pending.empty() && next_rx_us <= host_time_us && host_sreg_i)
+        {
+            deliver_rx((uint8_t)rx_pending[0]);
+            rx_pending.erase(0, 1);
+            next_rx_us = host_time_us + byte_us;
+        }
+        if (next_sample_us <= host_time_us && host_sreg_i)
+        {
+            deliver_sample();
+            next_sample_us += period;
+            // A loaded host cannot keep up, skip the samples that are already lost
+            if (next_sample_us + 100 * period < host_time_us)
+            {
+                uint64_t skipped = (host_time_us - next_sample_us) / period;
+                late_samples += skipped;
+                next_sample_us += skipped * period;
+            }
+        }
+
+        deliver_udre();
+        host_timer1_sync();
+        try
+        {
+            firmware_poll();
+        }
+        catch (const HostWatchdogReset &)
+        {
+            reboot();
+            next_sample_us = host_time_us;
+        }
+        // A single conversion of the idle rate completes before the next iteration
+        if (host_adc_single())
+        {
+            ADC = knob_value(host_time_us);
+            ADC_vect();
+        }
+        flush_tx();
+
+        if (host_time_us >= next_stats_us)
+        {
+            print_stats();
+            next_stats_us += stats_s * 1000000ULL;
+        }
+    }
+
+    print_stats();
+    if (link_path)
+        unlink(link_path);
+    return 0;
+}
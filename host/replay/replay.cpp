@@ -0,0 +1,865 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file replay.cpp
+ * @brief Host-side replay harness for recorded ADC traces and host command streams
+ *
+ * @details The harness links the unmodified firmware sources (src/main.cpp,
+ * Serial, TQueue, TM1637) against the stubbed register layer in host/stub and
+ * runs them as a discrete event simulation on a virtual clock:
+ *
+ * - every Timer0 compare period one sample of the ADC trace is delivered to ADC_vect()
+ * - host bytes arrive at the USART line rate through USART_RX_vect()
+ * - Timer1 follows the virtual clock between main loop iterations and transmitted bytes
+ * - _delay_us() and transmitted bytes advance the virtual clock, so blocking
+ *   display writes and TX time delay the main loop exactly as on the board
+ *
+ * The run is fully deterministic. Every transmitted message is printed with the
+ * sample index and virtual time, followed by a summary with the report rate and
+ * the report latency. A knob move is a sample differing from the last report by
+ * more than the step threshold, its latency is the number of samples (and the
+ * virtual time) until the next report. The output jitter counts the reports that
+ * reverse the direction of the previous report without a knob move and their
+ * size. --filter step runs the median filter in the step tracking mode. The
+ * reports sent within the new median window after a noise tuner report ('n') are
+ * counted, --still declares the input a still knob and exits with 1 on any of them.
+ *
+ * The modelled host honours the XON/XOFF flow control of the firmware: after an
+ * XOFF it sends at most --flow-lag more bytes (RX_FLOW_SLACK by default) and waits
+ * for XON, held bytes are sent later. A flow byte written by the UDRE interrupt is
+ * taken to reach the host two byte times after the interrupt that requested it, the
+ * worst case with one byte in UDR0 and one being shifted out, or two byte times
+ * after the end of a capture frame sent at that time. --no-flow makes the
+ * host ignore XOFF. The summary reports the flow bytes, the time the host was
+ * stopped and the most received bytes that waited in the queue. An overflow of the
+ * queue while the host honours the flow control exits with 1.
+ *
+ * A probe on the CLK and DIO lines of the volume display decodes the TM1637 bus
+ * traffic into frames and checks every edge against the datasheet timing, the
+ * summary reports the frame count, the bus time per frame and the violations.
+ * --tm1637 also prints every decoded frame and violation. --format NUM,DECIMALS,TEXT
+ * prints NUM with printFormatted() before the trace starts and compares the frame
+ * on the bus with the frame of the right aligned TEXT, a mismatch exits with 1.
+ *
+ * Usage: replay --adc trace.txt | --samples N [--script events.txt] [--rx-raw stream.bin] [--rx-blast N line]
+ *               [--flow-lag N] [--no-flow] [--step N] [--filter median|step] [--tm1637] [--quiet]
+ *               [--format NUM,DECIMALS,TEXT]... [--still]
+ *
+ * ADC trace: one sample (0-1023) per line, '#' starts a comment. --samples N runs N
+ * samples of 0 instead, for a signal generator selected with the 'g' command.
+ *
+ * Event script: one event per line, "<sample> rx <payload>" sends the payload
+ * (C escapes \n, \r, \\ and \xHH are supported), "<sample> button" presses the
+ * mute button and "<sample> key <n> down|up" presses or releases media key n. A key
+ * change bounces: the pin toggles KEY_BOUNCE_EDGES times KEY_BOUNCE_US apart before
+ * it settles. Without a script the harness sends the 'w' handshake at sample 0.
+ *
+ * Raw stream: bytes sent back to back at line rate from time 0. --rx-blast N line
+ * appends the handshake and N copies of the escaped line, back to back at line rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "Firmware.h"
+#include "tm1637_probe.h"
+
+ISR(ADC_vect);
+ISR(INT0_vect);
+ISR(PCINT2_vect);
+
+#define POLL_COST_US 4 // Virtual time of one main loop iteration without delays
+#define WATCHDOG_RESET_US 15000 // Time from wdt_enable() to the restart
+#define DEFAULT_STEP 8 // Default change against the last report counted as a knob move
+#define KEY_BOUNCE_EDGES 4 // Bounce edges of a key change before the final edge
+#define KEY_BOUNCE_US 300 // Time between the bounce edges of a key
+
+/**
+ * @brief Kinds of injected events
+ */
+enum EventKind : uint8_t
+{
+    EVENT_RX, ///< Received byte
+    EVENT_BUTTON, ///< Mute button press
+    EVENT_KEY ///< Media key change, the data is the key with KEY_PRESSED for a press
+};
+
+/**
+ * @brief Event injected by the harness
+ */
+struct Event
+{
+    uint64_t time_us; ///< Arrival time for raw bytes, 0 for script events
+    uint32_t sample; ///< Sample index for script events
+    EventKind kind; ///< Kind of the event
+    uint8_t data; ///< Received byte or key change
+};
+
+/**
+ * @brief Message transmitted by the firmware
+ */
+struct Message
+{
+    uint32_t sample; ///< Number of ADC samples delivered before the message completed
+    uint64_t time_us; ///< Virtual time of the message end
+    std::string text; ///< Message without the line end
+};
+
+static std::vector<uint16_t> trace; ///< ADC trace
+static std::vector<Event> events; ///< Script and raw stream events, in delivery order
+static std::vector<Message> messages; ///< Transmitted messages
+
+static uint32_t byte_us = 0; ///< Duration of one byte on the line
+static uint64_t tx_free_us = 0; ///< Time when the transmitter accepts the next byte
+static uint64_t tx_bytes = 0; ///< Number of transmitted bytes
+static std::string tx_line; ///< Partially transmitted message
+static uint32_t samples_fired = 0; ///< Number of delivered ADC samples
+
+// Report latency tracking
+static char have_report = 0;
+static uint16_t last_report = 0;
+static char change_pending = 0;
+static uint32_t change_sample = 0;
+static uint64_t change_time_us = 0;
+static uint16_t step_threshold = DEFAULT_STEP;
+static char step_filter = 0; ///< Run the median filter in the step tracking mode
+static uint32_t tune_reports_until = 0; ///< Last sample of the window after the last tuner report
+static char tuned = 0; ///< A tuner report was sent
+static uint32_t tunes = 0; ///< Tuner reports
+static uint32_t tune_reports = 0; ///< Reports within the window after a tuner report
+
+// Output jitter, a report reversing the direction of the previous report
+static int last_delta = 0;
+static uint32_t reversals = 0;
+static uint64_t reversal_sum = 0;
+static uint32_t reversal_max = 0;
+static std::vector<uint32_t> latencies;
+static std::vector<uint64_t> latencies_us;
+
+static uint32_t resets = 0;
+static uint32_t rx_overflows = 0;
+
+// Flow control of the modelled host
+static char host_flow = 1; ///< The host honours XOFF
+static uint32_t flow_lag = RX_FLOW_SLACK; ///< Bytes the host still sends after it received XOFF
+static char host_stopped = 0; ///< XOFF received and XON not yet
+static uint64_t host_stop_us = 0; ///< Time the stopped host sends its last byte
+static uint64_t stopped_since_us = 0; ///< Time of the XOFF that stopped the host
+static uint64_t stopped_us = 0; ///< Total time the host was stopped
+static uint64_t next_rx_us = 0; ///< Earliest time of the next received byte
+static uint32_t xoffs = 0;
+static uint32_t xons = 0;
+static uint8_t max_waiting = 0; ///< Most received bytes waiting in the queue
+static char in_udre = 0; ///< The UDRE interrupt is writing
+static uint64_t udre_time_us = 0; ///< Time of the interrupt that requested the flow byte
+static char in_hold = 0; ///< The firmware is sending a run of bytes that holds the flow bytes
+static uint64_t hold_from_us = 0; ///< Start of the last held run
+static uint64_t hold_until_us = 0; ///< End of the last held run on the line
+
+// Sequence numbers of stamped reports
+static uint16_t next_seq = 0;
+static uint32_t seq_gaps = 0;
+
+static Tm1637Probe display_probe('D', PORTD5, PORTD6, &PIND); ///< Probe on the volume display lines
+
+/**
+ * @brief Formatted number compared with its expected text
+ */
+struct FormatCase
+{
+    int16_t num; ///< Number passed to printFormatted()
+    uint8_t decimals; ///< Decimals passed to printFormatted()
+    std::string text; ///< Expected text, right aligned
+};
+
+static std::vector<FormatCase> format_cases; ///< --format cases
+
+static const uint8_t key_pins[] = {KEY_PLAY, KEY_NEXT, KEY_PREVIOUS}; ///< Port D bits of the keys, as in firmware_init
+static uint8_t keys_down = 0; ///< PIND mask of the pressed keys
+
+// Function to calculate the current Timer0 compare period in microseconds
+static uint32_t timer0_period_us()
+{
+    uint32_t prescaler = host_timer_prescaler(TCCR0B);
+    if (prescaler == 0)
+        return 0;
+    return (uint32_t)((uint64_t)(OCR0A + 1) * prescaler * 1000000UL / FOSC);
+}
+
+// Function to start the firmware with a fresh Timer1
+static void start_firmware()
+{
+    host_timer1_start();
+    // The pull-ups hold the pins of released keys high
+    for (uint8_t pin : key_pins)
+        PIND |= 1 << pin;
+    PIND &= ~keys_down;
+    firmware_init();
+    serial.setStepTracking(step_filter);
+}
+
+// Function to record a completed message and update the latency statistics
+static void record_message(const std::string &text)
+{
+    messages.push_back(Message{samples_fired, host_time_us, text});
+    if (text.size() > 1 && text[0] == 'n')
+    {
+        // "n<window>,<bias>,<noise>,<blocks>", the filter takes the new window from the next sample
+        tunes++;
+        tuned = 1;
+        tune_reports_until = samples_fired + (uint32_t)atoi(text.c_str() + 1);
+        return;
+    }
+    if (text.empty() || text.find_first_not_of("0123456789,") != std::string::npos)
+        return;
+    if (tuned && samples_fired <= tune_reports_until)
+        tune_reports++;
+    // A stamped report is "<value>,<sequence>,<time>"
+    size_t comma = text.find(',');
+    if (comma != std::string::npos)
+    {
+        uint16_t seq = (uint16_t)atoi(text.c_str() + comma + 1);
+        if (seq != next_seq)
+            seq_gaps++;
+        next_seq = seq + 1;
+    }
+    else
+    {
+        next_seq++;
+    }
+    uint16_t value = (uint16_t)atoi(text.c_str());
+    if (have_report && value != last_report)
+    {
+        // A report answering a knob move is never counted as jitter
+        int delta = (int)value - (int)last_report;
+        if (!change_pending && ((delta > 0 && last_delta < 0) || (delta < 0 && last_delta > 0)))
+        {
+            uint32_t size = (uint32_t)(delta < 0 ? -delta : delta);
+            reversals++;
+            reversal_sum += size;
+            if (size > reversal_max)
+                reversal_max = size;
+        }
+        last_delta = delta;
+    }
+    last_report = value;
+    have_report = 1;
+    if (change_pending)
+    {
+        latencies.push_back(samples_fired - change_sample);
+        latencies_us.push_back(host_time_us - change_time_us);
+        change_pending = 0;
+    }
+}
+
+// Function to follow a flow byte that reached the host at the given time
+static void on_flow(uint8_t data, uint64_t time_us)
+{
+    if (data == FLOW_XOFF)
+    {
+        xoffs++;
+        if (host_flow && !host_stopped)
+        {
+            host_stopped = 1;
+            stopped_since_us = time_us;
+            host_stop_us = time_us + (uint64_t)flow_lag * byte_us;
+        }
+        return;
+    }
+    xons++;
+    if (host_stopped)
+    {
+        host_stopped = 0;
+        stopped_us += time_us - stopped_since_us;
+        if (next_rx_us < time_us)
+            next_rx_us = time_us;
+    }
+}
+
+// TX hook, models the USART transmit time and splits the output into messages
+static void on_tx(uint8_t data)
+{
+    // Binary capture frames hold the flow bytes, so outside of them XON and XOFF are flow bytes
+    if (Features::flow_control && (data == FLOW_XON || data == FLOW_XOFF) && !Serial::flow_hold)
+    {
+        tx_bytes++;
+        if (in_udre)
+        {
+            // A flow byte requested during a held run waits for its end
+            uint64_t time_us = udre_time_us;
+            if (time_us >= hold_from_us && time_us < hold_until_us)
+                time_us = hold_until_us;
+            on_flow(data, time_us + 2 * byte_us);
+            return;
+        }
+        if (host_time_us < tx_free_us)
+            host_time_us = tx_free_us;
+        tx_free_us = host_time_us + byte_us;
+        host_timer1_sync();
+        on_flow(data, tx_free_us);
+        return;
+    }
+    // sendChar busy waits until the previous byte has been shifted out
+    if (host_time_us < tx_free_us)
+        host_time_us = tx_free_us;
+    if (Serial::flow_hold && !in_hold)
+        hold_from_us = host_time_us;
+    in_hold = Serial::flow_hold;
+    tx_free_us = host_time_us + byte_us;
+    if (in_hold)
+        hold_until_us = tx_free_us;
+    tx_bytes++;
+    host_timer1_sync();
+
+    if (data == '\n')
+    {
+        record_message(tx_line);
+        tx_line.clear();
+    }
+    else if (data == 'w' && tx_line.empty())
+    {
+        // The handshake reply is a single byte without a line end
+        record_message("w");
+    }
+    else
+    {
+        tx_line += (char)data;
+    }
+}
+
+// Function to run the UDRE interrupt when it is enabled, time_us is the time of its request
+static void deliver_udre(uint64_t time_us)
+{
+    if constexpr (Features::flow_control)
+    {
+        if (!host_sreg_i || !(UCSR0B & (1 << UDRIE0)))
+            return;
+        in_udre = 1;
+        udre_time_us = time_us;
+        USART_UDRE_vect();
+        in_udre = 0;
+    }
+}
+
+// Function to deliver one received byte through the RX interrupt
+static void deliver_rx(uint8_t data, uint64_t time_us)
+{
+    if (!(UCSR0B & (1 << RXCIE0)))
+        return;
+    if ((Serial::ser_buf.iPushPos + 1) % QUEUE_MAXCOUNT == Serial::ser_buf.iPopPos)
+        rx_overflows++;
+    host_rx_data = data;
+    USART_RX_vect();
+    if (Serial::rxWaiting() > max_waiting)
+        max_waiting = Serial::rxWaiting();
+    // The XOFF is requested by the RX interrupt of the byte that filled the queue
+    deliver_udre(time_us);
+}
+
+// Function to deliver one ADC sample through the ADC interrupt
+static void deliver_sample()
+{
+    uint16_t value = trace[samples_fired++];
+    if (host_adc_triggered())
+    {
+        ADC = value;
+        ADC_vect();
+        // A selected signal generator replaces the trace value
+        value = signal_gen.lastSample();
+    }
+    if (have_report && !change_pending)
+    {
+        uint16_t difference = (value > last_report) ? value - last_report : last_report - value;
+        if (difference > step_threshold)
+        {
+            change_pending = 1;
+            change_sample = samples_fired;
+            change_time_us = host_time_us;
+        }
+    }
+}
+
+// Function to restart the firmware after a watchdog reset
+static void reboot()
+{
+    resets++;
+    have_report = 0;
+    change_pending = 0;
+    last_delta = 0;
+    host_time_us += WATCHDOG_RESET_US;
+    host_reset_registers();
+    display_probe.reset();
+    // The old median filter array is leaked, the real MCU simply loses its RAM
+    new (&serial) Serial(SERIAL_BAUDRATE, MEDIAN_FILTER_SIZE, SENDING_BIAS, DOUBLE_SPEED);
+    new (&capture) AdcCapture();
+    next_seq = 0;
+    start_firmware();
+}
+
+// Function to set the level of a key pin and raise the pin change interrupt
+static void set_key_pin(uint8_t mask, char pressed)
+{
+    // Builds without the keys define no pin change interrupt
+    if constexpr (Features::keys)
+    {
+        uint8_t old_value = PIND;
+        if (pressed)
+            PIND &= ~mask;
+        else
+            PIND |= mask;
+        if (PIND != old_value && (PCICR & (1 << PCIE2)) && (PCMSK2 & mask))
+            PCINT2_vect();
+    }
+}
+
+// Function to deliver a bouncing key change, the bounce advances the virtual time
+static void deliver_key(uint8_t data)
+{
+    uint8_t key = data & ~KEY_PRESSED;
+    if (key >= sizeof(key_pins))
+        return;
+    uint8_t mask = 1 << key_pins[key];
+    char pressed = (data & KEY_PRESSED) != 0;
+    for (uint8_t i = 0; i < KEY_BOUNCE_EDGES; ++i)
+    {
+        set_key_pin(mask, (i & 1) ? !pressed : pressed);
+        host_time_us += KEY_BOUNCE_US;
+        host_timer1_sync();
+    }
+    set_key_pin(mask, pressed);
+    if (pressed)
+        keys_down |= mask;
+    else
+        keys_down &= ~mask;
+}
+
+// Function to parse one escaped script payload
+static std::string unescape(const char *s)
+{
+    std::string out;
+    while (*s && *s != '\n' && *s != '\r')
+    {
+        if (*s == '\\' && s[1])
+        {
+            s++;
+            if (*s == 'n')
+                out += '\n';
+            else if (*s == 'r')
+                out += '\r';
+            else if (*s == 'x' && s[1] && s[2])
+            {
+                char hex[3] = {s[1], s[2], '\0'};
+                out += (char)strtol(hex, NULL, 16);
+                s += 2;
+            }
+            else
+                out += *s;
+        }
+        else
+        {
+            out += *s;
+        }
+        s++;
+    }
+    return out;
+}
+
+// Function to load the ADC trace
+static char load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    char line[64];
+    while (fgets(line, sizeof(line), f))
+    {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        long value = strtol(line, NULL, 10);
+        trace.push_back((uint16_t)(value < 0 ? 0 : (value > 1023 ? 1023 : value)));
+    }
+    fclose(f);
+    return 1;
+}
+
+// Function to load the event script
+static char load_script(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f))
+    {
+        char *p = line;
+        if (*p == '#' || *p == '\n')
+            continue;
+        uint32_t sample = (uint32_t)strtoul(p, &p, 10);
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (strncmp(p, "button", 6) == 0)
+        {
+            events.push_back(Event{0, sample, EVENT_BUTTON, 0});
+        }
+        else if (strncmp(p, "key ", 4) == 0)
+        {
+            char *state;
+            uint8_t key = (uint8_t)strtoul(p + 4, &state, 10);
+            while (*state == ' ' || *state == '\t')
+                state++;
+            if (key < sizeof(key_pins) && strncmp(state, "down", 4) == 0)
+                events.push_back(Event{0, sample, EVENT_KEY, (uint8_t)(key | KEY_PRESSED)});
+            else if (key < sizeof(key_pins) && strncmp(state, "up", 2) == 0)
+                events.push_back(Event{0, sample, EVENT_KEY, key});
+            else
+                fprintf(stderr, "replay: invalid key event: %s", line);
+        }
+        else if (strncmp(p, "rx ", 3) == 0)
+        {
+            for (char c : unescape(p + 3))
+                events.push_back(Event{0, sample, EVENT_RX, (uint8_t)c});
+        }
+        else
+        {
+            fprintf(stderr, "replay: unknown event: %s", line);
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+// Function to load a raw byte stream sent at line rate
+static char load_raw(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    uint64_t time_us = 0;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+    {
+        events.push_back(Event{time_us, 0, EVENT_RX, (uint8_t)c});
+        time_us += byte_us;
+    }
+    fclose(f);
+    return 1;
+}
+
+// Function to append the handshake and count copies of a line, back to back at line rate
+static void add_blast(uint32_t count, const char *line)
+{
+    std::string payload = unescape(line);
+    uint64_t time_us = 0;
+    if (!events.empty() && events.back().time_us)
+        time_us = events.back().time_us + byte_us;
+    events.push_back(Event{time_us, 0, EVENT_RX, 'w'});
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        for (char c : payload)
+        {
+            time_us += byte_us;
+            events.push_back(Event{time_us, 0, EVENT_RX, (uint8_t)c});
+        }
+    }
+}
+
+// Function to parse a --format case "NUM,DECIMALS,TEXT"
+static char parse_format(const char *spec)
+{
+    char *end;
+    long num = strtol(spec, &end, 10);
+    if (*end != ',' || num < INT16_MIN || num > INT16_MAX)
+        return 0;
+    unsigned long decimals = strtoul(end + 1, &end, 10);
+    if (*end != ',' || decimals > UINT8_MAX)
+        return 0;
+    format_cases.push_back(FormatCase{(int16_t)num, (uint8_t)decimals, end + 1});
+    return 1;
+}
+
+// Function to send the queued display frame and return its segments
+static std::vector<uint8_t> flushed_segments()
+{
+    display.flush();
+    const std::vector<Tm1637Probe::Frame> &frames = display_probe.frames();
+    return frames.empty() ? std::vector<uint8_t>() : frames.back().segments;
+}
+
+// Function to compare every --format case with the frame of its text, returns the mismatches
+static uint32_t check_formats()
+{
+    uint32_t mismatches = 0;
+    for (const FormatCase &c : format_cases)
+    {
+        if (!Features::display_text)
+        {
+            printf("# format         %d,%u skipped, no text font\n", c.num, c.decimals);
+            continue;
+        }
+        display.flush();
+        char printed = display.printFormatted(c.num, c.decimals);
+        std::vector<uint8_t> segments = flushed_segments();
+        // The text fills the display from the left, the number area is right aligned in the first NUM_DIGITS
+        std::string text = c.text;
+        size_t glyphs = 0;
+        for (char ch : text)
+            glyphs += (ch != '.' && ch != ':');
+        if (glyphs < NUM_DIGITS)
+            text.insert(0, NUM_DIGITS - glyphs, ' ');
+        text.append(DISPLAY_DIGITS - NUM_DIGITS, ' ');
+        char expected = display.printText(text.c_str());
+        char match = printed && expected && segments == flushed_segments();
+        printf("# format         %d,%u -> \"%s\" %s\n", c.num, c.decimals, c.text.c_str(), match ? "ok" : "mismatch");
+        mismatches += !match;
+    }
+    return mismatches;
+}
+
+// Function to print a message with non-printable characters escaped
+static void print_message(const Message &m)
+{
+    printf("%8u %12.3f ", m.sample, m.time_us / 1000.0);
+    for (unsigned char c : m.text)
+    {
+        if (c >= 0x20 && c < 0x7F)
+            putchar(c);
+        else
+            printf("\\x%02x", c);
+    }
+    putchar('\n');
+}
+
+int main(int argc, char **argv)
+{
+    const char *adc_path = NULL;
+    const char *script_path = NULL;
+    const char *raw_path = NULL;
+    const char *blast_line = NULL;
+    uint32_t blast_count = 0;
+    uint32_t sample_count = 0;
+    char quiet = 0;
+    char show_frames = 0;
+    char still = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--adc") == 0 && i + 1 < argc)
+            adc_path = argv[++i];
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            sample_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc)
+            script_path = argv[++i];
+        else if (strcmp(argv[i], "--rx-raw") == 0 && i + 1 < argc)
+            raw_path = argv[++i];
+        else if (strcmp(argv[i], "--rx-blast") == 0 && i + 2 < argc)
+        {
+            blast_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+            blast_line = argv[++i];
+        }
+        else if (strcmp(argv[i], "--flow-lag") == 0 && i + 1 < argc)
+            flow_lag = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--no-flow") == 0)
+            host_flow = 0;
+        else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc)
+            step_threshold = (uint16_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            step_filter = strcmp(argv[++i], "step") == 0;
+        else if (strcmp(argv[i], "--tm1637") == 0)
+            show_frames = 1;
+        else if (strcmp(argv[i], "--quiet") == 0)
+            quiet = 1;
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc && parse_format(argv[i + 1]))
+            i++;
+        else if (strcmp(argv[i], "--still") == 0)
+            still = 1;
+        else
+        {
+            fprintf(stderr, "usage: %s --adc trace.txt | --samples N [--script events.txt] [--rx-raw stream.bin] [--rx-blast N line]\n"
+                            "       [--flow-lag N] [--no-flow] [--step N] [--filter median|step] [--tm1637] [--quiet]\n"
+                            "       [--format NUM,DECIMALS,TEXT]... [--still]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    byte_us = (10000000UL + LINE_BAUDRATE / 2) / LINE_BAUDRATE;
+    host_tx_hook = on_tx;
+
+    if (!adc_path)
+        trace.assign(sample_count, 0);
+    else if (!load_trace(adc_path))
+    {
+        fprintf(stderr, "replay: cannot read ADC trace\n");
+        return 1;
+    }
+    if (script_path && !load_script(script_path))
+    {
+        fprintf(stderr, "replay: cannot read script %s\n", script_path);
+        return 1;
+    }
+    if (raw_path && !load_raw(raw_path))
+    {
+        fprintf(stderr, "replay: cannot read raw stream %s\n", raw_path);
+        return 1;
+    }
+    if (blast_line)
+        add_blast(blast_count, blast_line);
+    if (!script_path && !raw_path && !blast_line)
+        events.push_back(Event{0, 0, EVENT_RX, 'w'});
+
+    display_probe.attach();
+    start_firmware();
+    uint32_t format_mismatches = check_formats();
+
+    size_t next_event = 0;
+    uint64_t next_tick_us = host_time_us + timer0_period_us();
+    while (samples_fired < trace.size())
+    {
+        // Deliver every interrupt that became due while the main loop was busy
+        char delivered;
+        do
+        {
+            delivered = 0;
+            if (!host_sreg_i)
+                break;
+            if (next_event < events.size())
+            {
+                const Event &e = events[next_event];
+                uint64_t due_us = e.time_us;
+                char due = e.time_us <= host_time_us && e.sample <= samples_fired;
+                // Script bytes of one event still arrive one byte time apart
+                if (due_us < next_rx_us)
+                    due_us = next_rx_us;
+                // A stopped host holds its bytes
+                if (e.kind == EVENT_RX && host_stopped && due_us >= host_stop_us)
+                    due = 0;
+                if (due && due_us <= host_time_us && due_us <= next_tick_us)
+                {
+                    if (e.kind == EVENT_BUTTON)
+                    {
+                        if (EIMSK & (1 << INT0))
+                            INT0_vect();
+                    }
+                    else if (e.kind == EVENT_KEY)
+                    {
+                        deliver_key(e.data);
+                    }
+                    else
+                    {
+                        deliver_rx(e.data, due_us);
+                        next_rx_us = due_us + byte_us;
+                    }
+                    next_event++;
+                    delivered = 1;
+                    continue;
+                }
+            }
+            if (next_tick_us <= host_time_us && samples_fired < trace.size())
+            {
+                deliver_sample();
+                uint32_t period = timer0_period_us();
+                next_tick_us += period ? period : 1000;
+                delivered = 1;
+            }
+        } while (delivered);
+        // Flow bytes requested by the main loop (XON) or held during a capture frame
+        deliver_udre(host_time_us);
+
+        host_timer1_sync();
+        try
+        {
+            firmware_poll();
+        }
+        catch (const HostWatchdogReset &)
+        {
+            reboot();
+            next_tick_us = host_time_us + timer0_period_us();
+        }
+        // A single conversion of the idle rate reads the knob of the current period
+        if (host_adc_single())
+        {
+            ADC = trace[samples_fired ? samples_fired - 1 : 0];
+            ADC_vect();
+        }
+        host_time_us += POLL_COST_US;
+    }
+
+    uint32_t reports = 0;
+    for (const Message &m : messages)
+    {
+        if (!quiet)
+            print_message(m);
+        if (!m.text.empty() && m.text.find_first_not_of("0123456789,") == std::string::npos)
+            reports++;
+    }
+
+    if (show_frames)
+        display_probe.printFrames(stdout);
+
+    double seconds = host_time_us / 1000000.0;
+    uint64_t latency_sum = 0;
+    uint32_t latency_max = 0;
+    for (uint32_t l : latencies)
+    {
+        latency_sum += l;
+        if (l > latency_max)
+            latency_max = l;
+    }
+    uint64_t latency_us_sum = 0;
+    uint64_t latency_us_max = 0;
+    for (uint64_t l : latencies_us)
+    {
+        latency_us_sum += l;
+        if (l > latency_us_max)
+            latency_us_max = l;
+    }
+    printf("# samples        %u\n", samples_fired);
+    printf("# virtual time   %.3f s\n", seconds);
+    printf("# messages       %zu\n", messages.size());
+    printf("# reports        %u\n", reports);
+    printf("# tx bytes       %llu\n", (unsigned long long)tx_bytes);
+    printf("# message rate   %.2f msg/s\n", seconds > 0 ? messages.size() / seconds : 0.0);
+    printf("# tx rate        %.1f B/s\n", seconds > 0 ? tx_bytes / seconds : 0.0);
+    printf("# latency        n=%zu mean=%.2f max=%u samples\n", latencies.size(),
+           latencies.empty() ? 0.0 : (double)latency_sum / latencies.size(), latency_max);
+    printf("# latency time   mean=%.2f max=%.2f ms\n",
+           latencies_us.empty() ? 0.0 : latency_us_sum / 1000.0 / latencies_us.size(), latency_us_max / 1000.0);
+    printf("# jitter         reversals=%u mean=%.2f max=%u LSB\n", reversals,
+           reversals ? (double)reversal_sum / reversals : 0.0, reversal_max);
+    if (Features::noise_tuning)
+        printf("# tuner          changes=%u, %u reports within the window after them%s\n", tunes, tune_reports,
+               still ? " (still knob)" : "");
+    printf("# rx overflows   %u\n", rx_overflows);
+    if (host_stopped)
+        stopped_us += host_time_us - stopped_since_us;
+    printf("# rx flow        xoff=%u xon=%u stopped=%.3f ms, max waiting %u bytes%s\n", xoffs, xons,
+           stopped_us / 1000.0, max_waiting, host_flow ? "" : " (ignored by the host)");
+    printf("# resets         %u\n", resets);
+    printf("# seq gaps       %u\n", seq_gaps);
+    display_probe.printSummary(stdout);
+    // With the flow control honoured the queue must never overflow
+    // On a still knob a new median window must not send reports
+    return ((host_flow && rx_overflows) || format_mismatches || (still && tune_reports)) ? 1 : 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tm1637_probe.h"
+#include <avr/io.h>
+
+static Tm1637Probe *probes[TM1637_PROBE_MAX]; ///< Attached probes
+static uint8_t probe_count = 0; ///< Number of attached probes
+
+// Constructor of a probe
+Tm1637Probe::Tm1637Probe(char port, uint8_t clk_bit, uint8_t dio_bit, volatile uint8_t *pin)
+    : port(port), clk_mask(1 << clk_bit), dio_mask(1 << dio_bit), pin(pin)
+{
+}
+
+// Function to start recording through the DDR write hook
+char Tm1637Probe::attach()
+{
+    if (probe_count == TM1637_PROBE_MAX)
+        return 0;
+    probes[probe_count++] = this;
+    host_ddr_hook = hook;
+    updatePin();
+    return 1;
+}
+
+// DDR write hook, forwards the write to the probes of the port
+void Tm1637Probe::hook(char port, uint8_t old_value, uint8_t new_value)
+{
+    for (uint8_t i = 0; i < probe_count; ++i)
+    {
+        if (probes[i]->port == port)
+            probes[i]->onWrite(old_value, new_value);
+    }
+}
+
+// Function to restart the decoder after a reset of the MCU
+void Tm1637Probe::reset()
+{
+    clk = 1;
+    dio = 1;
+    device_ack = 0;
+    ddr = 0;
+    in_transmission = 0;
+    bit = 0;
+    shift = 0;
+    bytes.clear();
+    frame_parts = 0;
+    updatePin();
+}
+
+// Function to record a violation at the current time
+void Tm1637Probe::violation(const char *text)
+{
+    errors.push_back(Violation{host_time_us, text});
+}
+
+// Function to show the line levels in the PIN register
+void Tm1637Probe::updatePin()
+{
+    uint8_t value = *pin & ~(clk_mask | dio_mask);
+    if (clk)
+        value |= clk_mask;
+    if (dio)
+        value |= dio_mask;
+    *pin = value;
+}
+
+// Function to follow one write of the data direction register
+void Tm1637Probe::onWrite(uint8_t old_value, uint8_t new_value)
+{
+    ddr = new_value;
+    char clk_changed = (old_value ^ new_value) & clk_mask;
+    char dio_changed = (old_value ^ new_value) & dio_mask;
+    if (clk_changed && dio_changed)
+        violation("CLK and DIO switched by one write");
+    if (clk_changed)
+        onClk(!(new_value & clk_mask));
+    // The TM1637 holds DIO low during the acknowledge
+    char level = !(new_value & dio_mask) && !device_ack;
+    if (level != dio)
+        onDio(level);
+    updatePin();
+}
+
+// Function to handle a CLK edge
+void Tm1637Probe::onClk(char level)
+{
+    uint64_t now = host_time_us;
+    edges++;
+    if (in_transmission && (now - clk_edge_us) * 1000 < TM1637_PW_CLK_NS)
+        violation(clk ? "CLK high pulse too short" : "CLK low pulse too short");
+    clk = level;
+    clk_edge_us = now;
+
+    if (clk)
+    {
+        clk_rise_us = now;
+        if (!in_transmission)
+            return;
+        if ((now - dio_edge_us) * 1000 < TM1637_SETUP_NS)
+            violation("DIO setup time before CLK rising edge too short");
+        bit++;
+        if (bit <= 8)
+        {
+            // LSB first
+            if (dio)
+                shift |= 1 << (bit - 1);
+        }
+        else if (ddr & dio_mask)
+        {
+            violation("DIO driven low by the MCU during the acknowledge clock");
+        }
+        return;
+    }
+
+    if (!in_transmission)
+        return;
+    if (bit == 8)
+    {
+        // The TM1637 acknowledges from the falling edge after the eighth bit
+        device_ack = 1;
+        if (dio)
+            onDio(0);
+    }
+    else if (bit == 9)
+    {
+        device_ack = 0;
+        bytes.push_back(shift);
+        bit = 0;
+        shift = 0;
+    }
+}
+
+// Function to handle a DIO edge
+void Tm1637Probe::onDio(char level)
+{
+    uint64_t now = host_time_us;
+    edges++;
+    dio = level;
+    dio_edge_us = now;
+    if (!clk)
+        return;
+
+    // DIO changing while CLK is high is a start (falling) or stop (rising) condition
+    if (in_transmission && (now - clk_rise_us) * 1000 < TM1637_HOLD_NS)
+        violation("DIO hold time after CLK rising edge too short");
+    if (!level)
+        startCondition();
+    else
+        stopCondition();
+}
+
+// Function to handle a start condition
+void Tm1637Probe::startCondition()
+{
+    if (in_transmission)
+        violation("start condition inside a transmission");
+    in_transmission = 1;
+    bit = 0;
+    shift = 0;
+    bytes.clear();
+    transmission_start_us = host_time_us;
+    transmission_edges = edges - 1;
+}
+
+// Function to handle a stop condition and decode the transmission
+void Tm1637Probe::stopCondition()
+{
+    if (!in_transmission)
+        return;
+    in_transmission = 0;
+    // The clock of the stop condition counts as the first bit of a byte
+    if (bit > 1)
+        violation("stop condition inside a byte");
+    if (bytes.empty())
+    {
+        violation("empty transmission");
+        return;
+    }
+
+    uint8_t command = bytes[0];
+    switch (command & 0xC0)
+    {
+    case 0x40:
+        // Data command, starts a frame
+        if (frame_parts != 0)
+            violation("data command before the previous frame was complete");
+        pending = Frame{};
+        pending.start_us = transmission_start_us;
+        pending.data_command = command;
+        pending.edges = transmission_edges;
+        frame_parts = 1;
+        break;
+    case 0xC0:
+        // Address command with the segment bytes
+        if (frame_parts != 1)
+            violation("address command without a data command");
+        pending.address = command;
+        pending.segments.assign(bytes.begin() + 1, bytes.end());
+        frame_parts = 2;
+        return;
+    case 0x80:
+        // Display control, ends the frame
+        if (frame_parts != 2)
+        {
+            violation("display control without data and address commands");
+            frame_parts = 0;
+            break;
+        }
+        pending.control = command;
+        pending.end_us = host_time_us;
+        pending.edges = edges - pending.edges;
+        decoded.push_back(pending);
+        frame_parts = 0;
+        break;
+    default:
+        violation("unknown command");
+        return;
+    }
+    if (bytes.size() != 1)
+        violation("command with extra bytes");
+}
+
+// Function to print every decoded frame
+void Tm1637Probe::printFrames(FILE *out) const
+{
+    for (const Frame &f : decoded)
+    {
+        fprintf(out, "tm1637 %12.3f bus %6.3f ms, %3u edges, data 0x%02X addr 0x%02X ctrl 0x%02X seg",
+                f.start_us / 1000.0, (f.end_us - f.start_us) / 1000.0, f.edges, f.data_command, f.address, f.control);
+        for (uint8_t s : f.segments)
+            fprintf(out, " %02X", s);
+        fputc('\n', out);
+    }
+    for (const Violation &v : errors)
+        fprintf(out, "tm1637 %12.3f violation: %s\n", v.time_us / 1000.0, v.text.c_str());
+}
+
+// Function to print the frame count, the bus time and the violations
+void Tm1637Probe::printSummary(FILE *out) const
+{
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    uint64_t edge_sum = 0;
+    for (const Frame &f : decoded)
+    {
+        uint64_t time = f.end_us - f.start_us;
+        sum += time;
+        edge_sum += f.edges;
+        if (time > max)
+            max = time;
+    }
+    size_t n = decoded.size();
+    fprintf(out, "# display frames %zu\n", n);
+    fprintf(out, "# display bus    mean=%.3f max=%.3f ms, %.1f edges/frame\n",
+            n ? sum / 1000.0 / n : 0.0, max / 1000.0, n ? (double)edge_sum / n : 0.0);
+    fprintf(out, "# display errors %zu\n", errors.size());
+}
@@ -0,0 +1,172 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define TM1637_PW_CLK_NS 400 // Minimum CLK pulse width (datasheet)
+#define TM1637_SETUP_NS 100 // Minimum DIO setup time before the CLK rising edge (datasheet)
+#define TM1637_HOLD_NS 100 // Minimum DIO hold time after the CLK rising edge (datasheet)
+#define TM1637_PROBE_MAX 4 // Maximum number of attached probes
+
+/**
+ * @brief Bus waveform recorder and decoder of one TM1637 display
+ *
+ * @details The probe follows the CLK and DIO lines through the writes of the data
+ * direction register (the lines are open drain, a set DDR bit pulls the line low)
+ * and emulates the acknowledge of the TM1637 by pulling DIO low from the falling
+ * edge after the eighth bit until the falling edge after the ninth clock, which
+ * the driver reads through the PIN register.
+ *
+ * Every edge is checked against the datasheet timing: CLK pulse width, DIO setup
+ * before and hold after the CLK rising edge, and DIO changes while CLK is high,
+ * which are only allowed as start or stop conditions. The transmissions between
+ * start and stop are decoded into commands, and a data command, an address
+ * command with the segment bytes and a display control command form one frame.
+ * The bus time of a frame runs from its first start to its last stop.
+ *
+ * The virtual clock of the simulation has a resolution of one microsecond, writes
+ * in the same microsecond are apart by 0 ns.
+ */
+class Tm1637Probe
+{
+public:
+    /**
+     * @brief Decoded display frame
+     */
+    struct Frame
+    {
+        uint64_t start_us; ///< Time of the first start condition
+        uint64_t end_us; ///< Time of the last stop condition
+        uint8_t data_command; ///< Data command (0x40 for automatic address increment)
+        uint8_t address; ///< Address command
+        uint8_t control; ///< Display control command (0x88 | brightness when on)
+        std::vector<uint8_t> segments; ///< Segment bytes
+        uint32_t edges; ///< Line transitions during the frame
+    };
+
+    /**
+     * @brief Timing or protocol violation
+     */
+    struct Violation
+    {
+        uint64_t time_us; ///< Time of the offending edge
+        std::string text; ///< Description
+    };
+
+    /**
+     * @brief Function to create a probe
+     *
+     * @param port Port letter of the lines ('B', 'C' or 'D')
+     * @param clk_bit Bit of CLK in the port
+     * @param dio_bit Bit of DIO in the port
+     * @param pin PIN register of the port, updated with the line levels
+     */
+    Tm1637Probe(char port, uint8_t clk_bit, uint8_t dio_bit, volatile uint8_t *pin);
+
+    /**
+     * @brief Function to start recording through the DDR write hook
+     *
+     * @return char 1 if attached, 0 if TM1637_PROBE_MAX probes are attached already
+     */
+    char attach();
+
+    /**
+     * @brief Function to restart the decoder after a reset of the MCU
+     */
+    void reset();
+
+    /**
+     * @brief Function to print every decoded frame
+     *
+     * @param out Output stream
+     */
+    void printFrames(FILE *out) const;
+
+    /**
+     * @brief Function to print the frame count, the bus time and the violations
+     *
+     * @param out Output stream
+     */
+    void printSummary(FILE *out) const;
+
+    /**
+     * @brief Function to get the decoded frames
+     *
+     * @return const std::vector<Frame>& Decoded frames
+     */
+    const std::vector<Frame> &frames() const
+    {
+        return decoded;
+    }
+
+    /**
+     * @brief Function to get the violations
+     *
+     * @return const std::vector<Violation>& Timing and protocol violations
+     */
+    const std::vector<Violation> &violations() const
+    {
+        return errors;
+    }
+
+private:
+    char port;
+    uint8_t clk_mask;
+    uint8_t dio_mask;
+    volatile uint8_t *pin;
+
+    // Line levels, 1 is released (high)
+    char clk = 1;
+    char dio = 1;
+    char device_ack = 0;
+    uint8_t ddr = 0; ///< Last written data direction register
+    uint64_t clk_edge_us = 0; ///< Time of the last CLK edge
+    uint64_t clk_rise_us = 0; ///< Time of the last CLK rising edge
+    uint64_t dio_edge_us = 0; ///< Time of the last DIO edge
+    uint32_t edges = 0;
+
+    // Transmission decoder
+    char in_transmission = 0;
+    uint8_t bit = 0; ///< Clock number in the current byte, 9 is the acknowledge
+    uint8_t shift = 0;
+    std::vector<uint8_t> bytes; ///< Bytes of the current transmission
+    uint64_t transmission_start_us = 0;
+    uint32_t transmission_edges = 0;
+
+    // Frame assembly
+    Frame pending = {};
+    uint8_t frame_parts = 0; ///< Transmissions of the pending frame
+    std::vector<Frame> decoded;
+    std::vector<Violation> errors;
+
+    void onWrite(uint8_t old_value, uint8_t new_value);
+    void onClk(char level);
+    void onDio(char level);
+    void startCondition();
+    void stopCondition();
+    void updatePin();
+    void violation(const char *text);
+
+    static void hook(char port, uint8_t old_value, uint8_t new_value);
+};
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file size_vectors.cpp
+ * @brief Stand-in for the vector table in a host link of a build variant
+ *
+ * @details The AVR image keeps what the reset vector and the interrupt vectors of
+ * the variant reach. This table references the same entry points, so a host link
+ * with -ffunction-sections, -fdata-sections and --gc-sections keeps the same
+ * functions and objects, and `size` of the program compares the variants and the
+ * single FEATURE_* switches without the AVR toolchain. The figures are x86-64
+ * code and data and include the stubs, so only the differences between two links
+ * say something about the AVR image, and only roughly. The Timer2
+ * vector of the profiler is AVR assembly and has no host build, so a profiling
+ * build only counts the C++ part of the profiler. The program is only linked,
+ * running it does nothing.
+ */
+
+#include <avr/interrupt.h>
+#include "Firmware.h"
+
+ISR(ADC_vect);
+ISR(INT0_vect);
+ISR(TIMER1_OVF_vect);
+#if FEATURE_KEYS
+ISR(PCINT2_vect);
+ISR(TIMER1_COMPB_vect);
+#endif
+
+// Reset and interrupt vectors of the variant
+static void (*const volatile vectors[])() = {
+    firmware_init,
+    firmware_poll,
+    ADC_vect,
+    INT0_vect,
+    TIMER1_OVF_vect,
+    USART_RX_vect,
+#if FEATURE_FLOW_CONTROL
+    USART_UDRE_vect,
+#endif
+#if FEATURE_KEYS
+    PCINT2_vect,
+    TIMER1_COMPB_vect,
+#endif
+};
+
+int main()
+{
+    // The volatile read keeps the table and everything it references
+    return vectors[0] ? 0 : 1;
+}
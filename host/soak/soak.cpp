@@ -0,0 +1,937 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file soak.cpp
+ * @brief Randomized soak run of the firmware logic under simulation
+ *
+ * @details The harness links the unmodified firmware sources against the stubbed
+ * register layer in host/stub and runs them on the virtual clock of the replay
+ * harness, but instead of a recorded trace it generates the load from a seeded
+ * random generator, so a failing run is repeated exactly with its seed:
+ *
+ * - the knob turns to a random target at a random speed and holds it for
+ *   HOLD_MS, every sample carries up to NOISE_LSB of noise
+ * - the host sends display lines, pings, mode toggles, memory and tuner queries,
+ *   resumes, bursts of lines and garbage bytes with Poisson arrivals at --load
+ *   percent of the line capacity, starts a capture session every --capture-s
+ *   seconds and resets the device every --reset-s seconds on average, followed
+ *   by a new handshake
+ * - the mute button and the media keys are pressed at random
+ *
+ * The modelled host honours the XON/XOFF flow control like the replay host and
+ * decodes the device output with the DeviceDecoder of the host application after
+ * every main loop iteration, so the decoder does not add to the measured stack. The
+ * commands that replace the input or block the main loop on purpose ('g', 'b',
+ * 'h') are not sent. Like a real host application, the host waits until its
+ * commands are answered before it starts a capture, and drops its queued
+ * commands when it resets the device.
+ *
+ * The summary reports the offered and delivered host traffic, the receive queue
+ * overflows, the ADC samples replaced in the mailbox before the main loop took
+ * them, the unanswered pings, the stale reports (the last report at the end of a
+ * hold does not match the held input within the sending bias and the noise),
+ * the late reports (a knob move answered later than --late-ms), the longest main
+ * loop iteration and the deepest stack of the main loop and of the interrupts.
+ * The stack depth is measured on the host by painting the stack below the call,
+ * so it compares runs and variants but is not the AVR figure, the 'm' command
+ * reports the margin on the board. The sum of both depths is marked in the
+ * stand-in RAM of the host stub above --heap-top, so the MemMonitor of the
+ * firmware sees it; a margin below MEM_MARGIN_MIN, in an 'm' reply or at the end
+ * of the run, exits with 1. The harness is linked with immediate binding
+ * (-Wl,-z,now), otherwise the lazy symbol lookup of the first call into the C
+ * library shows up as the deepest stack.
+ *
+ * The baud rate and the build variant are properties of the build: the
+ * PLATFORMIO_BUILD_FLAGS variable selects them for a matrix run, e.g.
+ * "-DFEATURES_MINIMAL -DSERIAL_BAUDRATE=9600UL -DDOUBLE_SPEED=0". An overflow of
+ * the queue while the host honours the flow control exits with 1.
+ *
+ * Usage: soak [--seed N] [--seconds S] [--load PERCENT] [--capture-s S] [--reset-s S]
+ *             [--button-ms MS] [--key-ms MS] [--late-ms MS] [--step N] [--flow-lag N] [--no-flow]
+ *             [--heap-top BYTES]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <new>
+#include <string>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "Firmware.h"
+#include "DeviceProtocol.h"
+#include "MemMonitor.h"
+
+ISR(ADC_vect);
+ISR(INT0_vect);
+ISR(PCINT2_vect);
+
+#define POLL_COST_US 4 // Virtual time of one main loop iteration without delays
+#define WATCHDOG_RESET_US 15000 // Time from wdt_enable() to the restart
+#define HOLD_MS 600 // Time the knob rests on a target, longer than a full median window at the sampling period
+#define NOISE_LSB 2 // Largest noise of a sample
+#define RAMP_MS_MAX 2000 // Slowest move of the knob
+#define BURST_MIN 8 // Fewest lines of a burst
+#define BURST_MAX 32 // Most lines of a burst
+#define GARBAGE_MAX 16 // Most garbage bytes in a row
+#define CAPTURE_MS_MAX 1000 // Longest capture session
+#define CAPTURE_QUIET_US 50000 // Time without a reply before the host starts a capture
+#define TX_PENDING_MAX 4096 // Transmitted bytes kept for the decoder during one iteration
+#define KEY_HOLD_MS 80 // Time a media key is held down
+#define HANDSHAKE_RETRY_US 500000 // Time the host waits for the handshake reply before it repeats it
+#define RESET_WAIT_US 100000 // Time the host waits after a reset before the handshake
+#define HOST_BACKLOG_MAX 65536 // Bytes the host application queues before it drops new commands
+#define STACK_PAINT 8192 // Bytes of host stack painted below a measured call
+#define STACK_CANARY 0xC5 // Paint pattern of the stack
+
+#if defined(FEATURES_MINIMAL)
+#define VARIANT_NAME "minimal"
+#elif defined(FEATURES_PRODUCTION)
+#define VARIANT_NAME "production"
+#elif defined(FEATURES_INSTRUMENTED)
+#define VARIANT_NAME "instrumented"
+#else
+#define VARIANT_NAME "full"
+#endif
+
+/**
+ * @brief Session state of the modelled host application
+ */
+enum HostSession : uint8_t
+{
+    SESSION_HANDSHAKE, ///< Handshake sent, waiting for the reply
+    SESSION_RUNNING, ///< Handshake answered, commands are sent
+    SESSION_RESETTING ///< Reset sent, waiting for the restart of the device
+};
+
+static uint64_t rng_state = 1; ///< State of the xorshift64* generator
+
+// Function to get the next random number
+static uint64_t rnd()
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Function to get a random number from 0 to n - 1
+static uint32_t uniform(uint32_t n)
+{
+    return n ? (uint32_t)(rnd() % n) : 0;
+}
+
+// Function to get an exponentially distributed interval of Poisson arrivals
+static uint64_t exponential_us(double mean_us)
+{
+    double u = (rnd() >> 11) * (1.0 / 9007199254740992.0);
+    return (uint64_t)(-mean_us * log(1.0 - u)) + 1;
+}
+
+// Run parameters
+static double duration_us = 60e6;
+static double load = 0.2; ///< Offered host traffic, fraction of the line capacity
+static double capture_mean_us = 15e6; ///< Mean time between capture sessions, 0 disables them
+static double reset_mean_us = 20e6; ///< Mean time between resets, 0 disables them
+static double button_mean_us = 10e6; ///< Mean time between mute button presses, 0 disables them
+static double key_mean_us = 5e6; ///< Mean time between media key presses, 0 disables them
+static uint64_t late_us = 100000; ///< Knob move to report latency counted as late
+static uint16_t step_threshold = 16; ///< Change against the last sent value counted as a knob move
+static uint16_t heap_top = 0; ///< Stand-in RAM below the stack taken by data, bss and heap
+
+static uint32_t byte_us = 0; ///< Duration of one byte on the line
+static uint64_t tx_free_us = 0; ///< Time when the transmitter accepts the next byte
+static uint64_t tx_bytes = 0; ///< Number of transmitted bytes
+static uint8_t tx_pending[TX_PENDING_MAX]; ///< Transmitted bytes not yet decoded
+static uint64_t tx_pending_us[TX_PENDING_MAX]; ///< Time each pending byte left the line
+static size_t tx_pending_count = 0;
+static uint64_t message_us = 0; ///< Time the decoded message reached the host
+
+// Modelled host application
+static DeviceDecoder decoder;
+static HostSession session = SESSION_HANDSHAKE;
+static uint64_t session_us = 0; ///< Time of the last handshake or reset
+static char host_capture = 0; ///< The host started a capture session
+static uint64_t capture_stop_us = 0; ///< Time the host ends the capture session
+static std::deque<uint8_t> host_out; ///< Bytes queued by the host application
+static uint64_t next_traffic_us = 0;
+static uint64_t next_capture_us = 0;
+static uint64_t next_reset_us = 0;
+static uint64_t offered = 0; ///< Bytes queued by the host application
+static uint64_t dropped = 0; ///< Bytes not queued because the backlog was full
+static uint64_t flushed = 0; ///< Queued bytes discarded by a reset
+static uint64_t delivered = 0; ///< Bytes received by the device
+static size_t max_backlog = 0;
+static uint32_t pings = 0; ///< Pings received by the running device
+static uint32_t ping_replies = 0;
+static uint32_t mem_replies = 0; ///< Answered 'm' queries
+static uint32_t mem_low = 0; ///< 'm' replies with the margin below MEM_MARGIN_MIN
+static uint32_t mem_margin = HOST_RAM_SIZE; ///< Smallest margin of the 'm' replies
+static uint64_t reply_us = 0; ///< Time of the last message other than a report
+static uint32_t handshakes = 0;
+static uint32_t captures = 0;
+static uint32_t bursts = 0;
+static uint32_t garbage = 0;
+
+// Flow control of the modelled host, as in the replay harness
+static char host_flow = 1; ///< The host honours XOFF
+static uint32_t flow_lag = RX_FLOW_SLACK; ///< Bytes the host still sends after it received XOFF
+static char host_stopped = 0; ///< XOFF received and XON not yet
+static uint64_t host_stop_us = 0; ///< Time the stopped host sends its last byte
+static uint64_t stopped_since_us = 0; ///< Time of the XOFF that stopped the host
+static uint64_t stopped_us = 0; ///< Total time the host was stopped
+static uint64_t next_rx_us = 0; ///< Earliest time of the next received byte
+static uint32_t xoffs = 0;
+static uint32_t xons = 0;
+static uint8_t max_waiting = 0; ///< Most received bytes waiting in the queue
+static char in_udre = 0; ///< The UDRE interrupt is writing
+static uint64_t udre_time_us = 0; ///< Time of the interrupt that requested the flow byte
+static char in_hold = 0; ///< The firmware is sending a run of bytes that holds the flow bytes
+static uint64_t hold_from_us = 0; ///< Start of the last held run
+static uint64_t hold_until_us = 0; ///< End of the last held run on the line
+
+// Knob model, a ramp from ramp_from to ramp_to followed by a hold
+static uint16_t ramp_from = 512;
+static uint16_t ramp_to = 512;
+static uint64_t ramp_start_us = 0;
+static uint64_t ramp_us = 0;
+static uint64_t hold_end_us = 0;
+static char hold_started = 0; ///< The knob reached the target
+static char hold_clean = 0; ///< The device reported freely during the whole hold
+static uint32_t holds = 0;
+static uint32_t stale = 0;
+
+// Report latency and loss
+static char have_report = 0;
+static uint32_t last_report = 0;
+static char change_pending = 0;
+static uint64_t change_time_us = 0;
+static uint32_t moves = 0;
+static uint32_t late = 0;
+static uint64_t latency_sum_us = 0;
+static uint64_t latency_max_us = 0;
+static uint64_t samples = 0;
+static uint64_t lost_samples = 0;
+static uint8_t last_lost = 0; ///< adc_mailbox.lost() at the last sample
+
+// Main loop and interrupts
+static uint64_t polls = 0;
+static uint64_t poll_max_us = 0;
+static uint64_t busy_polls = 0; ///< Iterations that advanced the clock beyond POLL_COST_US
+static uint64_t busy_sum_us = 0;
+static uint32_t main_stack = 0; ///< Deepest host stack of a main loop iteration
+static uint32_t isr_stack = 0; ///< Deepest host stack of an interrupt
+static char reset_pending = 0; ///< The last iteration ran into the watchdog
+static uint32_t resets = 0;
+static uint32_t rx_overflows = 0;
+static uint32_t buttons = 0;
+static uint32_t key_presses = 0;
+
+static const uint8_t key_pins[] = {KEY_PLAY, KEY_NEXT, KEY_PREVIOUS}; ///< Port D bits of the keys, as in firmware_init
+static uint8_t key_down = 0; ///< PIND mask of the pressed key
+static uint64_t next_button_us = 0;
+static uint64_t next_key_us = 0;
+
+static uintptr_t stack_floor = 0; ///< Lowest painted stack address
+
+// Function to paint the stack below the caller
+__attribute__((noinline)) static void paint_stack()
+{
+    volatile uint8_t area[STACK_PAINT];
+    for (size_t i = 0; i < sizeof(area); ++i)
+        area[i] = STACK_CANARY;
+    stack_floor = (uintptr_t)area;
+}
+
+// Function to find the lowest stack address written since paint_stack()
+__attribute__((noinline)) static uintptr_t stack_low_water()
+{
+    volatile uint8_t *p = (volatile uint8_t *)stack_floor;
+    while (p < (volatile uint8_t *)stack_floor + STACK_PAINT && *p == STACK_CANARY)
+        p++;
+    return (uintptr_t)p;
+}
+
+// Function to run a call on a painted stack and return the bytes it used below the caller
+__attribute__((noinline)) static uint32_t measured(void (*call)())
+{
+    uintptr_t top = (uintptr_t)__builtin_frame_address(0);
+    paint_stack();
+    call();
+    return (uint32_t)(top - stack_low_water());
+}
+
+// Function to run an interrupt and keep its deepest stack
+static void run_isr(void (*isr)())
+{
+    uint32_t depth = measured(isr);
+    if (depth > isr_stack)
+    {
+        isr_stack = depth;
+        host_ram_use(main_stack + isr_stack);
+    }
+}
+
+// Function to run one main loop iteration, a watchdog reset is only flagged
+static void poll_once()
+{
+    try
+    {
+        firmware_poll();
+    }
+    catch (const HostWatchdogReset &)
+    {
+        reset_pending = 1;
+    }
+}
+
+// Function to calculate the current Timer0 compare period in microseconds
+static uint32_t timer0_period_us()
+{
+    uint32_t prescaler = host_timer_prescaler(TCCR0B);
+    if (prescaler == 0)
+        return 0;
+    return (uint32_t)((uint64_t)(OCR0A + 1) * prescaler * 1000000UL / FOSC);
+}
+
+// Function to start the firmware with a fresh Timer1
+static void start_firmware()
+{
+    host_timer1_start();
+    // The pull-ups hold the pins of released keys high
+    for (uint8_t pin : key_pins)
+        PIND |= 1 << pin;
+    PIND &= ~key_down;
+    firmware_init();
+    last_lost = adc_mailbox.lost();
+}
+
+// Function to check if the device reports the knob freely
+static char reporting()
+{
+    return main_state == STATE_RUNNING && !mute_mailbox.peek() && !(Features::capture && capture.isActive());
+}
+
+// Function to handle one message decoded by the host
+static void on_message(const DeviceMessage &m)
+{
+    if (m.kind == DEVICE_HANDSHAKE)
+    {
+        if (session == SESSION_HANDSHAKE)
+        {
+            session = SESSION_RUNNING;
+            next_traffic_us = message_us;
+        }
+        return;
+    }
+    if (m.kind != DEVICE_REPORT)
+        reply_us = message_us;
+    if (m.kind == DEVICE_REPLY && m.tag == 'p')
+    {
+        ping_replies++;
+        return;
+    }
+    if (m.kind == DEVICE_REPLY && m.tag == 'm' && m.count == 5)
+    {
+        mem_replies++;
+        if (m.values[0] < mem_margin)
+            mem_margin = m.values[0];
+        if (m.values[0] < MEM_MARGIN_MIN || !m.values[4])
+            mem_low++;
+        return;
+    }
+    if (m.kind != DEVICE_REPORT)
+        return;
+    // A report also tells that a repeated handshake found the device running
+    if (session == SESSION_HANDSHAKE)
+    {
+        session = SESSION_RUNNING;
+        next_traffic_us = message_us;
+    }
+    if (!reporting())
+        return;
+    last_report = m.values[0];
+    have_report = 1;
+    if (change_pending)
+    {
+        uint64_t latency = message_us - change_time_us;
+        latency_sum_us += latency;
+        if (latency > latency_max_us)
+            latency_max_us = latency;
+        if (latency > late_us)
+            late++;
+        change_pending = 0;
+    }
+}
+
+// Function to follow a flow byte that reached the host at the given time
+static void on_flow(uint8_t data, uint64_t time_us)
+{
+    if (data == FLOW_XOFF)
+    {
+        xoffs++;
+        if (host_flow && !host_stopped)
+        {
+            host_stopped = 1;
+            stopped_since_us = time_us;
+            host_stop_us = time_us + (uint64_t)flow_lag * byte_us;
+        }
+        return;
+    }
+    xons++;
+    if (host_stopped)
+    {
+        host_stopped = 0;
+        stopped_us += time_us - stopped_since_us;
+        if (next_rx_us < time_us)
+            next_rx_us = time_us;
+    }
+}
+
+// Function to decode the bytes transmitted during the last iteration
+static void decode_tx()
+{
+    for (size_t i = 0; i < tx_pending_count; ++i)
+    {
+        message_us = tx_pending_us[i];
+        decoder.feed(&tx_pending[i], 1, on_message);
+    }
+    tx_pending_count = 0;
+}
+
+// TX hook, models the USART transmit time and keeps the output for the host decoder
+static void on_tx(uint8_t data)
+{
+    // Binary capture frames hold the flow bytes, so outside of them XON and XOFF are flow bytes
+    if (Features::flow_control && (data == FLOW_XON || data == FLOW_XOFF) && !Serial::flow_hold)
+    {
+        tx_bytes++;
+        if (in_udre)
+        {
+            // A flow byte requested during a held run waits for its end
+            uint64_t time_us = udre_time_us;
+            if (time_us >= hold_from_us && time_us < hold_until_us)
+                time_us = hold_until_us;
+            on_flow(data, time_us + 2 * byte_us);
+            return;
+        }
+        if (host_time_us < tx_free_us)
+            host_time_us = tx_free_us;
+        tx_free_us = host_time_us + byte_us;
+        host_timer1_sync();
+        on_flow(data, tx_free_us);
+        return;
+    }
+    // sendChar busy waits until the previous byte has been shifted out
+    if (host_time_us < tx_free_us)
+        host_time_us = tx_free_us;
+    if (Serial::flow_hold && !in_hold)
+        hold_from_us = host_time_us;
+    in_hold = Serial::flow_hold;
+    tx_free_us = host_time_us + byte_us;
+    if (in_hold)
+        hold_until_us = tx_free_us;
+    tx_bytes++;
+    host_timer1_sync();
+    if (tx_pending_count == TX_PENDING_MAX)
+        decode_tx();
+    tx_pending[tx_pending_count] = data;
+    tx_pending_us[tx_pending_count++] = tx_free_us;
+}
+
+// Function to run the UDRE interrupt when it is enabled, time_us is the time of its request
+static void deliver_udre(uint64_t time_us)
+{
+    if constexpr (Features::flow_control)
+    {
+        if (!host_sreg_i || !(UCSR0B & (1 << UDRIE0)))
+            return;
+        in_udre = 1;
+        udre_time_us = time_us;
+        run_isr(USART_UDRE_vect);
+        in_udre = 0;
+    }
+}
+
+// Function to deliver one received byte through the RX interrupt
+static void deliver_rx(uint8_t data, uint64_t time_us)
+{
+    delivered++;
+    if (Features::diagnostics && data == 'p' && main_state != STATE_HANDSHAKE)
+        pings++;
+    if (!(UCSR0B & (1 << RXCIE0)))
+        return;
+    if ((Serial::ser_buf.iPushPos + 1) % QUEUE_MAXCOUNT == Serial::ser_buf.iPopPos)
+        rx_overflows++;
+    host_rx_data = data;
+    run_isr(USART_RX_vect);
+    if (Serial::rxWaiting() > max_waiting)
+        max_waiting = Serial::rxWaiting();
+    // The XOFF is requested by the RX interrupt of the byte that filled the queue
+    deliver_udre(time_us);
+}
+
+// Function to calculate the knob position at the current time
+static uint16_t knob_position()
+{
+    uint64_t elapsed = host_time_us - ramp_start_us;
+    if (elapsed >= ramp_us)
+        return ramp_to;
+    int32_t span = (int32_t)ramp_to - (int32_t)ramp_from;
+    return (uint16_t)(ramp_from + (int32_t)(span * (int64_t)elapsed / (int64_t)ramp_us));
+}
+
+// Function to check the last report at the end of a hold and start the next move
+static void next_move()
+{
+    if (hold_clean && have_report && reporting())
+    {
+        // The median is within the noise of the input, the last report within the bias of the median
+        uint16_t tolerance = serial.sendingBias() + NOISE_LSB + 1;
+        uint16_t low = ramp_to > tolerance ? ramp_to - tolerance : 0;
+        uint16_t high = ramp_to + tolerance < 1023 ? ramp_to + tolerance : 1023;
+        holds++;
+        if (last_report < serial.mapValue(low) || last_report > serial.mapValue(high))
+            stale++;
+    }
+    ramp_from = ramp_to;
+    ramp_to = (uint16_t)uniform(1024);
+    ramp_start_us = host_time_us;
+    ramp_us = (50 + uniform(RAMP_MS_MAX - 50)) * 1000ULL;
+    hold_end_us = ramp_start_us + ramp_us + HOLD_MS * 1000ULL;
+    hold_started = 0;
+    hold_clean = 0;
+}
+
+// Function to read the noisy knob
+static uint16_t knob_sample()
+{
+    int32_t value = knob_position() + (int32_t)uniform(2 * NOISE_LSB + 1) - NOISE_LSB;
+    return (uint16_t)(value < 0 ? 0 : (value > 1023 ? 1023 : value));
+}
+
+// Function to run the ADC interrupt with one converted sample
+static void convert_sample(uint16_t value)
+{
+    ADC = value;
+    run_isr(ADC_vect);
+    // The handshake leaves the mailbox alone on purpose
+    if (main_state == STATE_RUNNING)
+        lost_samples += (uint8_t)(adc_mailbox.lost() - last_lost);
+    last_lost = adc_mailbox.lost();
+}
+
+// Function to deliver one ADC sample through the ADC interrupt
+static void deliver_sample()
+{
+    uint16_t value = knob_sample();
+    // The hold is checked from its first sample
+    if (!hold_started && host_time_us - ramp_start_us >= ramp_us)
+    {
+        hold_started = 1;
+        hold_clean = reporting();
+    }
+    if (!reporting())
+    {
+        hold_clean = 0;
+        change_pending = 0;
+    }
+    samples++;
+    if (host_adc_triggered())
+        convert_sample(value);
+    if (have_report && !change_pending && reporting())
+    {
+        uint16_t last = (uint16_t)serial.lastSent();
+        uint16_t difference = (value > last) ? value - last : last - value;
+        // With a volume curve only a changed step is reported
+        if (difference > step_threshold && serial.mapValue(value) != serial.mapValue(last))
+        {
+            moves++;
+            change_pending = 1;
+            change_time_us = host_time_us;
+        }
+    }
+}
+
+// Function to queue bytes of the host application
+static void host_send(const std::string &bytes)
+{
+    if (host_out.size() + bytes.size() > HOST_BACKLOG_MAX)
+    {
+        dropped += bytes.size();
+        return;
+    }
+    host_out.insert(host_out.end(), bytes.begin(), bytes.end());
+    offered += bytes.size();
+    if (host_out.size() > max_backlog)
+        max_backlog = host_out.size();
+}
+
+// Function to queue the handshake, "w" or "v<curve>"
+static void send_handshake()
+{
+    uint8_t command[DEVICE_COMMAND_MAX];
+    size_t length;
+    if (Features::curves && uniform(2))
+        length = device_handshake(command, sizeof(command), (int)uniform(CURVE_COUNT));
+    else
+        length = device_handshake(command, sizeof(command));
+    host_send(std::string((const char *)command, length));
+    handshakes++;
+    session = SESSION_HANDSHAKE;
+    session_us = host_time_us;
+}
+
+// Function to build a display line or a ping
+static std::string random_line()
+{
+    if (Features::diagnostics && !host_capture && uniform(3) == 0)
+    {
+        return "p" + std::to_string(uniform(100000)) + "\n";
+    }
+    return std::to_string(uniform(1000)) + "\n";
+}
+
+// Function to build a row of garbage bytes, control and high bytes without a command meaning
+static std::string random_garbage()
+{
+    std::string bytes;
+    uint32_t count = 1 + uniform(GARBAGE_MAX);
+    while (bytes.size() < count)
+    {
+        uint8_t c = (uint8_t)uniform(256);
+        if ((c < 0x20 && c != '\n' && c != FLOW_XON && c != FLOW_XOFF && c != RESUME_BYTE) || c >= 0x80)
+            bytes += (char)c;
+    }
+    return bytes;
+}
+
+// Function to generate the next command of the host application
+static void generate_traffic()
+{
+    std::string bytes;
+    uint32_t pick = uniform(100);
+    if (host_capture)
+    {
+        // Only the lines without a reply keep the capture frames intact
+        if (pick < 80)
+            bytes = random_line();
+        else
+        {
+            bytes = random_garbage();
+            garbage++;
+        }
+    }
+    else if (pick < 40)
+        bytes = random_line();
+    else if (pick < 55)
+        bytes = "tfl"[uniform(3)];
+    else if (pick < 62)
+        bytes = "mn"[uniform(2)];
+    else if (pick < 66)
+        bytes = (char)RESUME_BYTE;
+    else if (pick < 78)
+    {
+        uint32_t count = BURST_MIN + uniform(BURST_MAX - BURST_MIN + 1);
+        for (uint32_t i = 0; i < count; ++i)
+            bytes += random_line();
+        bursts++;
+    }
+    else if (pick < 90)
+    {
+        bytes = random_garbage();
+        garbage++;
+    }
+    else
+        bytes = random_line();
+    host_send(bytes);
+    // The offered traffic averages load times the line capacity
+    next_traffic_us = host_time_us + exponential_us(bytes.size() * byte_us / load);
+}
+
+// Function to run the host application up to the current time
+static void run_host()
+{
+    if (session == SESSION_RESETTING && host_time_us - session_us >= RESET_WAIT_US)
+    {
+        decoder.reset();
+        send_handshake();
+    }
+    else if (session == SESSION_HANDSHAKE && host_time_us - session_us >= HANDSHAKE_RETRY_US)
+        send_handshake();
+    else if (session == SESSION_RUNNING)
+    {
+        if (reset_mean_us > 0 && host_time_us >= next_reset_us)
+        {
+            // The commands still queued are meant for the old session, the line end
+            // closes a command cut by the flush, which would take the reset as its argument
+            flushed += host_out.size();
+            host_out.clear();
+            host_send("\nr");
+            host_capture = 0;
+            session = SESSION_RESETTING;
+            session_us = host_time_us;
+            next_reset_us = host_time_us + exponential_us(reset_mean_us);
+        }
+        else if (host_capture && host_time_us >= capture_stop_us)
+        {
+            host_send("c");
+            host_capture = 0;
+            next_capture_us = host_time_us + exponential_us(capture_mean_us);
+        }
+        else if (Features::capture && capture_mean_us > 0 && !host_capture && host_time_us >= next_capture_us)
+        {
+            // A reply inside the capture would break the frames, so the host stops and waits for the replies first
+            if (host_out.empty() && host_time_us >= reply_us + CAPTURE_QUIET_US)
+            {
+                host_send("c");
+                host_capture = 1;
+                capture_stop_us = host_time_us + (100 + uniform(CAPTURE_MS_MAX - 100)) * 1000ULL;
+                captures++;
+            }
+        }
+        else if (load > 0 && host_time_us >= next_traffic_us)
+            generate_traffic();
+    }
+}
+
+// Function to restart the firmware after a watchdog reset
+static void reboot()
+{
+    resets++;
+    have_report = 0;
+    change_pending = 0;
+    hold_clean = 0;
+    host_time_us += WATCHDOG_RESET_US;
+    host_reset_registers();
+    // The old median filter array is leaked, the real MCU simply loses its RAM
+    new (&serial) Serial(SERIAL_BAUDRATE, MEDIAN_FILTER_SIZE, SENDING_BIAS, DOUBLE_SPEED);
+    new (&capture) AdcCapture();
+    start_firmware();
+}
+
+// Function to set the level of a key pin and raise the pin change interrupt
+static void set_key_pin(uint8_t mask, char pressed)
+{
+    if constexpr (Features::keys)
+    {
+        uint8_t old_value = PIND;
+        if (pressed)
+            PIND &= ~mask;
+        else
+            PIND |= mask;
+        if (PIND != old_value && (PCICR & (1 << PCIE2)) && (PCMSK2 & mask))
+            run_isr(PCINT2_vect);
+    }
+}
+
+// Function to press the mute button or a media key, or release the pressed key
+static void run_buttons()
+{
+    if (button_mean_us > 0 && host_time_us >= next_button_us)
+    {
+        buttons++;
+        hold_clean = 0;
+        change_pending = 0;
+        if (EIMSK & (1 << INT0))
+            run_isr(INT0_vect);
+        next_button_us = host_time_us + exponential_us(button_mean_us);
+    }
+    if (!Features::keys || key_mean_us <= 0)
+        return;
+    if (key_down && host_time_us >= next_key_us)
+    {
+        set_key_pin(key_down, 0);
+        key_down = 0;
+        next_key_us = host_time_us + exponential_us(key_mean_us);
+    }
+    else if (!key_down && host_time_us >= next_key_us)
+    {
+        key_presses++;
+        key_down = 1 << key_pins[uniform(sizeof(key_pins))];
+        set_key_pin(key_down, 1);
+        next_key_us = host_time_us + KEY_HOLD_MS * 1000ULL;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t seed = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            duration_us = atof(argv[++i]) * 1e6;
+        else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+            load = atof(argv[++i]) / 100.0;
+        else if (strcmp(argv[i], "--capture-s") == 0 && i + 1 < argc)
+            capture_mean_us = atof(argv[++i]) * 1e6;
+        else if (strcmp(argv[i], "--reset-s") == 0 && i + 1 < argc)
+            reset_mean_us = atof(argv[++i]) * 1e6;
+        else if (strcmp(argv[i], "--button-ms") == 0 && i + 1 < argc)
+            button_mean_us = atof(argv[++i]) * 1e3;
+        else if (strcmp(argv[i], "--key-ms") == 0 && i + 1 < argc)
+            key_mean_us = atof(argv[++i]) * 1e3;
+        else if (strcmp(argv[i], "--late-ms") == 0 && i + 1 < argc)
+            late_us = (uint64_t)(atof(argv[++i]) * 1e3);
+        else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc)
+            step_threshold = (uint16_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--flow-lag") == 0 && i + 1 < argc)
+            flow_lag = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--no-flow") == 0)
+            host_flow = 0;
+        else if (strcmp(argv[i], "--heap-top") == 0 && i + 1 < argc)
+            heap_top = (uint16_t)atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: %s [--seed N] [--seconds S] [--load PERCENT] [--capture-s S] [--reset-s S]\n"
+                            "       [--button-ms MS] [--key-ms MS] [--late-ms MS] [--step N] [--flow-lag N] [--no-flow]\n"
+                            "       [--heap-top BYTES]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    // xorshift needs a state other than 0
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    byte_us = (10000000UL + LINE_BAUDRATE / 2) / LINE_BAUDRATE;
+    host_tx_hook = on_tx;
+    host_ram_heap_top = heap_top;
+    next_capture_us = capture_mean_us > 0 ? exponential_us(capture_mean_us) : 0;
+    next_reset_us = reset_mean_us > 0 ? exponential_us(reset_mean_us) : 0;
+    next_button_us = button_mean_us > 0 ? exponential_us(button_mean_us) : 0;
+    next_key_us = key_mean_us > 0 ? exponential_us(key_mean_us) : 0;
+    next_move();
+
+    start_firmware();
+    send_handshake();
+
+    uint64_t next_tick_us = host_time_us + timer0_period_us();
+    while (host_time_us < duration_us)
+    {
+        // Deliver every interrupt that became due while the main loop was busy
+        char busy = 0;
+        char progress;
+        do
+        {
+            progress = 0;
+            if (!host_sreg_i)
+                break;
+            run_host();
+            run_buttons();
+            if (host_time_us >= hold_end_us)
+                next_move();
+            uint64_t due_us = next_rx_us;
+            // A stopped host holds its bytes
+            if (!host_out.empty() && due_us <= host_time_us && due_us <= next_tick_us &&
+                !(host_stopped && due_us >= host_stop_us))
+            {
+                uint8_t data = host_out.front();
+                host_out.pop_front();
+                deliver_rx(data, due_us);
+                next_rx_us = due_us + byte_us;
+                progress = 1;
+            }
+            else if (next_tick_us <= host_time_us)
+            {
+                deliver_sample();
+                uint32_t period = timer0_period_us();
+                next_tick_us += period ? period : 1000;
+                progress = 1;
+            }
+            busy |= progress;
+        } while (progress);
+        // An idle host keeps its line rate for the next byte
+        if (host_out.empty() && next_rx_us < host_time_us)
+            next_rx_us = host_time_us;
+        // Flow bytes requested by the main loop (XON) or held during a capture frame
+        deliver_udre(host_time_us);
+
+        host_timer1_sync();
+        uint64_t start_us = host_time_us;
+        // Iterations with new input go deep, the idle ones are only sampled
+        if (busy || Serial::rxWaiting() || (polls & 63) == 0)
+        {
+            uint32_t depth = measured(poll_once);
+            if (!reset_pending && depth > main_stack)
+                main_stack = depth;
+            // An interrupt may arrive at the deepest point of the main loop
+            host_ram_use(main_stack + isr_stack);
+        }
+        else
+            poll_once();
+        polls++;
+        // A single conversion of the idle rate completes before the next iteration
+        if (host_adc_single())
+            convert_sample(knob_sample());
+        decode_tx();
+        if (reset_pending)
+        {
+            reset_pending = 0;
+            reboot();
+            next_tick_us = host_time_us + timer0_period_us();
+        }
+        else
+        {
+            uint64_t iteration_us = host_time_us - start_us + POLL_COST_US;
+            if (iteration_us > poll_max_us)
+                poll_max_us = iteration_us;
+            if (iteration_us > POLL_COST_US)
+            {
+                busy_polls++;
+                busy_sum_us += iteration_us;
+            }
+        }
+        host_time_us += POLL_COST_US;
+    }
+
+    double seconds = host_time_us / 1000000.0;
+    const DeviceDecoderStats &stats = decoder.stats();
+    if (host_stopped)
+        stopped_us += host_time_us - stopped_since_us;
+    printf("# soak           variant=%s baud=%lu seed=%llu load=%.0f%% virtual time %.3f s\n", VARIANT_NAME,
+           (unsigned long)LINE_BAUDRATE, (unsigned long long)seed, load * 100, seconds);
+    printf("# host traffic   offered=%.1f B/s delivered=%.1f B/s dropped=%llu B flushed=%llu B, max backlog %zu B\n",
+           offered / seconds, delivered / seconds, (unsigned long long)dropped, (unsigned long long)flushed, max_backlog);
+    printf("# device output  %.1f B/s (%.1f%% of the line), %llu messages, %llu reports, %llu frames, %llu decode errors\n",
+           tx_bytes / seconds, 100.0 * tx_bytes * byte_us / host_time_us, (unsigned long long)stats.messages,
+           (unsigned long long)stats.reports, (unsigned long long)stats.frames, (unsigned long long)stats.errors);
+    printf("# rx overflows   %u\n", rx_overflows);
+    printf("# rx flow        xoff=%u xon=%u stopped=%.3f ms, max waiting %u bytes%s\n", xoffs, xons,
+           stopped_us / 1000.0, max_waiting, host_flow ? "" : " (ignored by the host)");
+    printf("# lost samples   %llu of %llu\n", (unsigned long long)lost_samples, (unsigned long long)samples);
+    printf("# pings          %u received, %u answered\n", pings, ping_replies);
+    printf("# stale reports  %u of %u holds\n", stale, holds);
+    printf("# late reports   %u of %u knob moves over %.1f ms, latency mean=%.2f max=%.2f ms\n", late, moves,
+           late_us / 1000.0, moves ? latency_sum_us / 1000.0 / moves : 0.0, latency_max_us / 1000.0);
+    printf("# main loop      %llu iterations, max=%.3f ms, busy mean=%.3f ms\n", (unsigned long long)polls,
+           poll_max_us / 1000.0, busy_polls ? busy_sum_us / 1000.0 / busy_polls : 0.0);
+    printf("# host stack     main=%u isr=%u bytes (x86-64 frames, relative only)\n", main_stack, isr_stack);
+    uint16_t margin = MemMonitor::margin();
+    printf("# memory margin  %u bytes above heap top %u, %u of %u 'm' replies below %u (smallest %u)\n", margin,
+           heap_top, mem_low, mem_replies, MEM_MARGIN_MIN, mem_replies ? mem_margin : margin);
+    printf("# events         resets=%u handshakes=%u buttons=%u keys=%u captures=%u bursts=%u garbage=%u\n",
+           resets, handshakes, buttons, key_presses, captures, bursts, garbage);
+    // With the flow control honoured the queue must never overflow, and the stack must keep its margin
+    return ((host_flow && rx_overflows) || mem_low || margin < MEM_MARGIN_MIN) ? 1 : 0;
+}
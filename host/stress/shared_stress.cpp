@@ -0,0 +1,220 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file shared_stress.cpp
+ * @brief Interrupt interleaving stress run of the Shared snapshot and mailbox
+ *
+ * @details The host build of Shared.h calls host_preempt() before every byte it
+ * copies, which is where an interrupt can split a multi-byte access on the MCU.
+ * This program hooks that call and runs a writer "ISR" there:
+ *
+ * - sweep: for every preemption point of a read, one run with a single interrupt
+ *   exactly at that point
+ * - storm: interrupts at random preemption points with the given probability
+ *
+ * Every written value has all bytes equal, so a torn read shows up as a value
+ * with different bytes. A plain volatile copy without the sequence counter is
+ * run the same way for comparison. The program exits with 1 on a torn or stale
+ * read of the snapshot or the mailbox.
+ *
+ * Usage: shared_stress [--reads N] [--chance PERCENT] [--seed N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "Shared.h"
+
+void (*host_preempt_hook)() = nullptr;
+
+static Snapshot<uint32_t> snapshot; ///< Snapshot under test
+static Mailbox<uint32_t> mailbox; ///< Mailbox under test
+static volatile uint8_t plain[sizeof(uint32_t)]; ///< Unprotected copy of the value
+
+static uint8_t written = 0; ///< Byte of the last written value
+static char in_isr = 0; ///< The writer runs, its own accesses are not preempted
+static uint32_t points = 0; ///< Preemption points passed in the current read
+static uint32_t fire_at = 0; ///< Preemption point of the single interrupt, 0 for none
+static uint32_t chance = 0; ///< Interrupt probability per point in percent (storm)
+static uint32_t rng = 1; ///< Random generator state
+static uint32_t interrupts = 0; ///< Number of writer runs
+static uint32_t last_take = 0; ///< Writer runs before the last successful take
+
+// Function to make a value with all bytes equal
+static uint32_t pattern(uint8_t byte)
+{
+    return 0x01010101UL * byte;
+}
+
+// Function to check that all bytes of a value are equal
+static char consistent(uint32_t value)
+{
+    return value == pattern((uint8_t)value);
+}
+
+// Writer ISR, publishes the next value through every primitive
+static void writer_isr()
+{
+    in_isr = 1;
+    written++;
+    uint32_t value = pattern(written);
+    snapshot.write(value);
+    mailbox.post(value);
+    shared_copy(plain, (const volatile uint8_t *)&value, sizeof(value));
+    interrupts++;
+    in_isr = 0;
+}
+
+// Preemption hook, decides if the writer interrupts the reader here
+static void preempt()
+{
+    if (in_isr)
+        return;
+    points++;
+    char fire;
+    if (chance)
+    {
+        // xorshift32
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        fire = rng % 100 < chance;
+    }
+    else
+    {
+        fire = points == fire_at;
+    }
+    if (fire)
+        writer_isr();
+}
+
+/**
+ * @brief Counters of one reader
+ */
+struct Result
+{
+    uint32_t reads; ///< Completed reads
+    uint32_t torn; ///< Reads with different bytes
+    uint32_t stale; ///< Reads older than the last value written before the read ended
+};
+
+// Function to check one read value
+static void check(Result &r, uint32_t value, uint8_t before)
+{
+    r.reads++;
+    if (!consistent(value))
+        r.torn++;
+    // The read must return a value written during or after its start
+    else if ((uint8_t)((uint8_t)value - before) > (uint8_t)(written - before))
+        r.stale++;
+}
+
+// Function to run one read of every primitive
+static void read_all(Result &snap, Result &box, Result &naive, uint32_t &box_misses)
+{
+    uint8_t before = written;
+    points = 0;
+    check(snap, snapshot.read(), before);
+
+    before = written;
+    uint32_t value = 0;
+    points = 0;
+    if (mailbox.take(value))
+    {
+        check(box, value, before);
+        last_take = interrupts;
+    }
+    else if ((interrupts - last_take) % 128 != 0)
+    {
+        // Posts since the last take are lost unless exactly 128 wrapped the 8-bit sequence counter
+        box_misses++;
+    }
+
+    before = written;
+    points = 0;
+    shared_copy((volatile uint8_t *)&value, plain, sizeof(value));
+    check(naive, value, before);
+}
+
+// Function to print the counters of one reader
+static void print_result(const char *name, const Result &r)
+{
+    printf("  %-10s reads %8u  torn %6u  stale %6u\n", name, r.reads, r.torn, r.stale);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t reads = 100000;
+    uint32_t storm_chance = 20;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--reads") == 0 && i + 1 < argc)
+            reads = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--chance") == 0 && i + 1 < argc)
+            storm_chance = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            rng = (uint32_t)strtoul(argv[++i], NULL, 10) | 1;
+        else
+        {
+            fprintf(stderr, "usage: %s [--reads N] [--chance PERCENT] [--seed N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (storm_chance >= 100)
+        storm_chance = 99; // Every point would starve the reader, as it would on the MCU
+
+    host_preempt_hook = preempt;
+    writer_isr();
+    uint32_t misses = 0;
+    char failed = 0;
+
+    // Sweep, one interrupt at each preemption point of a read and its retries
+    Result snap = {}, box = {}, naive = {};
+    for (uint32_t point = 1; point <= 4 * (sizeof(uint32_t) + 1); ++point)
+    {
+        fire_at = point;
+        writer_isr(); // Fresh value for the mailbox
+        read_all(snap, box, naive, misses);
+    }
+    printf("sweep, %u interrupts\n", interrupts);
+    print_result("snapshot", snap);
+    print_result("mailbox", box);
+    print_result("plain", naive);
+    failed |= snap.torn || snap.stale || box.torn || box.stale;
+
+    // Storm, random interrupts at any preemption point
+    uint32_t sweep_interrupts = interrupts;
+    Result storm_snap = {}, storm_box = {}, storm_naive = {};
+    fire_at = 0;
+    chance = storm_chance;
+    for (uint32_t i = 0; i < reads; ++i)
+        read_all(storm_snap, storm_box, storm_naive, misses);
+    chance = 0;
+    printf("storm, %u%% per point, %u interrupts\n", storm_chance, interrupts - sweep_interrupts);
+    print_result("snapshot", storm_snap);
+    print_result("mailbox", storm_box);
+    print_result("plain", storm_naive);
+    printf("mailbox values replaced before take %u (wraps at 256), missed takes %u\n", mailbox.lost(), misses);
+    failed |= storm_snap.torn || storm_snap.stale || storm_box.torn || storm_box.stale || misses;
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
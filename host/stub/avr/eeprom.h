@@ -0,0 +1,53 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host build stand-in for <avr/eeprom.h>
+
+#pragma once
+
+#include <string.h>
+#include "../host_avr.h"
+
+#define E2END 0x3FF // Last EEPROM address of the ATmega328P
+#define EEMEM
+
+// The EEPROM keeps its contents over a host_reset_registers() like the chip
+extern uint8_t host_eeprom[E2END + 1];
+
+static inline uint8_t eeprom_read_byte(const uint8_t *address)
+{
+    return host_eeprom[(uintptr_t)address & E2END];
+}
+
+static inline void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+    host_eeprom[(uintptr_t)address & E2END] = value;
+}
+
+static inline void eeprom_read_block(void *destination, const void *source, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+        ((uint8_t *)destination)[i] = eeprom_read_byte((const uint8_t *)source + i);
+}
+
+static inline void eeprom_update_block(const void *source, void *destination, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+        eeprom_update_byte((uint8_t *)destination + i, ((const uint8_t *)source)[i]);
+}
@@ -0,0 +1,30 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host build stand-in for <avr/interrupt.h>
+
+#pragma once
+
+#include "../host_avr.h"
+
+// Interrupt vectors become plain functions the harness can call
+#define ISR(vector, ...) extern "C" void vector(void)
+
+#define sei() (host_sreg_i = 1)
+#define cli() (host_sreg_i = 0)
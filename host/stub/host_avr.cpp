@@ -0,0 +1,265 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "host_avr.h"
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+ISR(TIMER1_OVF_vect);
+// Only programs using the compare match B interrupt define it
+extern "C" void TIMER1_COMPB_vect(void) __attribute__((weak));
+
+uint64_t host_time_us = 0;
+uint8_t host_sreg_i = 0;
+uint8_t host_rx_data = 0;
+void (*host_tx_hook)(uint8_t) = nullptr;
+void (*host_preempt_hook)() = nullptr;
+void (*host_ddr_hook)(char, uint8_t, uint8_t) = nullptr;
+
+HostDdr DDRB = {'B', 0};
+HostDdr DDRC = {'C', 0};
+HostDdr DDRD = {'D', 0};
+volatile uint8_t PORTB, PINB;
+volatile uint8_t PORTC, PINC;
+volatile uint8_t PORTD, PIND;
+
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ADC;
+
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0;
+HostFlags TIFR0;
+
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+HostFlags TIFR1;
+volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2;
+HostFlags TIFR2;
+
+volatile uint8_t EICRA, EIMSK, EIFR, PCICR, PCMSK0, PCMSK1, PCMSK2;
+HostFlags PCIFR;
+
+// Constant initialized, so the registers are valid in static constructors (global Serial object)
+volatile uint8_t UCSR0A = (1 << UDRE0) | (1 << TXC0);
+volatile uint8_t UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+HostUdr UDR0;
+
+HostSreg SREG;
+
+// Erased EEPROM, every byte reads 0xFF until the program writes it
+uint8_t host_eeprom[E2END + 1];
+static const char host_eeprom_erased = (memset(host_eeprom, 0xFF, sizeof(host_eeprom)), 1);
+volatile uint8_t MCUSR;
+volatile uint16_t SP = 0x08FF;
+
+// Painted stand-in RAM, nothing used until a harness reports a stack depth
+uint8_t host_ram[HOST_RAM_SIZE];
+uint16_t host_ram_heap_top = 0;
+static const char host_ram_painted = (memset(host_ram, HOST_RAM_PAINT, sizeof(host_ram)), 1);
+
+static uint64_t timer1_sync_us = 0; ///< Virtual time of the last Timer1 sync
+static uint32_t timer1_cycles = 0; ///< CPU cycles counted towards the next Timer1 tick
+
+HostUdr::operator uint8_t() const
+{
+    return host_rx_data;
+}
+
+HostUdr &HostUdr::operator=(uint8_t data)
+{
+    if (host_tx_hook)
+        host_tx_hook(data);
+    return *this;
+}
+
+HostDdr &HostDdr::operator=(uint8_t data)
+{
+    uint8_t old_value = value;
+    value = data;
+    if (host_ddr_hook)
+        host_ddr_hook(port, old_value, data);
+    return *this;
+}
+
+HostSreg::operator uint8_t() const
+{
+    return host_sreg_i ? (1 << SREG_I) : 0;
+}
+
+HostSreg &HostSreg::operator=(uint8_t value)
+{
+    host_sreg_i = (value >> SREG_I) & 1;
+    return *this;
+}
+
+void host_reset_registers()
+{
+    DDRB = PORTB = PINB = 0;
+    DDRC = PORTC = PINC = 0;
+    DDRD = PORTD = PIND = 0;
+    ADMUX = ADCSRA = ADCSRB = DIDR0 = 0;
+    ADC = 0;
+    TCCR0A = TCCR0B = TCNT0 = OCR0A = OCR0B = TIMSK0 = 0;
+    TIFR0.value = 0;
+    TCCR1A = TCCR1B = TCCR1C = TIMSK1 = 0;
+    TIFR1.value = 0;
+    TCNT1 = OCR1A = OCR1B = ICR1 = 0;
+    TCCR2A = TCCR2B = TCNT2 = OCR2A = OCR2B = TIMSK2 = 0;
+    TIFR2.value = 0;
+    EICRA = EIMSK = EIFR = PCICR = PCMSK0 = PCMSK1 = PCMSK2 = 0;
+    PCIFR.value = 0;
+    // The transmitter is always ready, the harness consumes bytes immediately
+    UCSR0A = (1 << UDRE0) | (1 << TXC0);
+    UCSR0B = UCSR0C = UBRR0H = UBRR0L = 0;
+    MCUSR = 0;
+    SP = 0x08FF;
+    host_sreg_i = 0;
+    if (host_ram_heap_top < HOST_RAM_SIZE)
+        memset(host_ram + host_ram_heap_top, HOST_RAM_PAINT, HOST_RAM_SIZE - host_ram_heap_top);
+}
+
+void host_ram_use(uint32_t bytes)
+{
+    if (bytes == 0)
+        return;
+    if (bytes > HOST_RAM_SIZE)
+        bytes = HOST_RAM_SIZE;
+    // Any value other than the paint marks the byte as used
+    host_ram[HOST_RAM_SIZE - bytes] = (uint8_t)~HOST_RAM_PAINT;
+}
+
+uint32_t host_timer_prescaler(uint8_t tccrb)
+{
+    switch (tccrb & 0x07)
+    {
+    case 1:
+        return 1;
+    case 2:
+        return 8;
+    case 3:
+        return 64;
+    case 4:
+        return 256;
+    case 5:
+        return 1024;
+    default:
+        return 0;
+    }
+}
+
+void host_timer1_start()
+{
+    timer1_sync_us = host_time_us;
+    timer1_cycles = 0;
+    TCNT1 = 0;
+}
+
+void host_timer1_sync()
+{
+    uint64_t cycles = (host_time_us - timer1_sync_us) * (HOST_F_CPU / 1000000UL) + timer1_cycles;
+    timer1_sync_us = host_time_us;
+    uint32_t prescaler = host_timer_prescaler(TCCR1B);
+    if (prescaler == 0)
+    {
+        timer1_cycles = 0;
+        return;
+    }
+    // Count on from TCNT1, so writes of the program and prescaler changes take effect
+    timer1_cycles = cycles % prescaler;
+    uint64_t count = TCNT1;
+    uint64_t ticks = count + cycles / prescaler;
+    while (count < ticks)
+    {
+        // Next overflow or compare match B, the interrupts may change OCR1B
+        uint64_t overflow = (count | 0xFFFF) + 1;
+        uint64_t compare = (count & ~(uint64_t)0xFFFF) + OCR1B;
+        if (compare <= count)
+            compare += 0x10000;
+        uint64_t next = overflow < compare ? overflow : compare;
+        if (next > ticks)
+            break;
+        count = next;
+        TCNT1 = (uint16_t)next;
+        if (next == compare)
+        {
+            if ((TIMSK1 & (1 << OCIE1B)) && host_sreg_i && TIMER1_COMPB_vect)
+                TIMER1_COMPB_vect();
+            else
+                TIFR1.raise(1 << OCF1B);
+        }
+        if (next == overflow)
+        {
+            if ((TIMSK1 & (1 << TOIE1)) && host_sreg_i)
+                TIMER1_OVF_vect();
+            else
+                TIFR1.raise(1 << TOV1);
+        }
+    }
+    TCNT1 = (uint16_t)ticks;
+}
+
+char host_adc_triggered()
+{
+    if (!(ADCSRA & (1 << ADEN)) || !(ADCSRA & (1 << ADIE)) || !(ADCSRA & (1 << ADATE)))
+        return 0;
+    ADCSRA &= ~(1 << ADSC);
+    return 1;
+}
+
+char host_adc_single()
+{
+    if (!(ADCSRA & (1 << ADEN)) || !(ADCSRA & (1 << ADIE)) || (ADCSRA & (1 << ADATE)))
+        return 0;
+    if (!(ADCSRA & (1 << ADSC)) || !host_sreg_i)
+        return 0;
+    ADCSRA &= ~(1 << ADSC);
+    return 1;
+}
+
+char *ultoa(unsigned long val, char *s, int radix)
+{
+    char tmp[33];
+    int len = 0;
+    do
+    {
+        unsigned long digit = val % radix;
+        tmp[len++] = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        val /= radix;
+    } while (val);
+    for (int i = 0; i < len; ++i)
+        s[i] = tmp[len - 1 - i];
+    s[len] = '\0';
+    return s;
+}
+
+char *utoa(unsigned int val, char *s, int radix)
+{
+    return ultoa(val, s, radix);
+}
+
+char *itoa(int val, char *s, int radix)
+{
+    if (val < 0 && radix == 10)
+    {
+        s[0] = '-';
+        ultoa((unsigned long)(-(long)val), s + 1, radix);
+        return s;
+    }
+    return ultoa((unsigned int)val, s, radix);
+}
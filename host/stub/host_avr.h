@@ -0,0 +1,394 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * @brief Stubbed ATmega328P register layer for host builds
+ *
+ * @details The firmware sources include <avr/io.h>, <avr/interrupt.h>,
+ * <util/delay.h> and <avr/wdt.h>. In the host build these resolve to the
+ * headers in host/stub, which map every register used by the project to a
+ * plain variable. Registers with side effects on the real chip (UDR0, SREG)
+ * and the data direction registers are small classes that forward to the host
+ * harness. Delays advance a virtual
+ * clock instead of sleeping, so every run is deterministic.
+ */
+
+/**
+ * @brief USART data register
+ *
+ * @details Writing pushes a byte to the TX hook, reading returns the byte
+ * injected by the harness before it calls USART_RX_vect().
+ */
+struct HostUdr
+{
+    operator uint8_t() const;
+    HostUdr &operator=(uint8_t data);
+};
+
+/**
+ * @brief Data direction register
+ *
+ * @details Every write is passed to host_ddr_hook, so a probe can follow the
+ * open-drain lines that the TM1637 driver switches through the data direction.
+ */
+struct HostDdr
+{
+    const char port; ///< Port letter
+    uint8_t value; ///< Register value
+
+    operator uint8_t() const
+    {
+        return value;
+    }
+    HostDdr &operator=(uint8_t data);
+    HostDdr &operator|=(int mask)
+    {
+        return *this = (uint8_t)(value | mask);
+    }
+    HostDdr &operator&=(int mask)
+    {
+        return *this = (uint8_t)(value & mask);
+    }
+    HostDdr &operator^=(int mask)
+    {
+        return *this = (uint8_t)(value ^ mask);
+    }
+};
+
+/**
+ * @brief Interrupt flag register
+ *
+ * @details Writing a one clears the flag as on the chip, so "TIFR1 = (1 << TOV1)"
+ * clears a pending overflow and "|=" clears every set flag. The emulated
+ * peripherals raise the flags with raise().
+ */
+struct HostFlags
+{
+    uint8_t value; ///< Register value
+
+    operator uint8_t() const
+    {
+        return value;
+    }
+    HostFlags &operator=(uint8_t data)
+    {
+        value &= ~data;
+        return *this;
+    }
+    HostFlags &operator|=(int mask)
+    {
+        return *this = (uint8_t)(value | mask);
+    }
+    void raise(uint8_t mask)
+    {
+        value |= mask;
+    }
+};
+
+/**
+ * @brief Status register
+ * 
+ * @details The I bit mirrors host_sreg_i, so saving SREG, cli() and restoring SREG
+ * behaves as on the chip.
+ */
+struct HostSreg
+{
+    operator uint8_t() const;
+    HostSreg &operator=(uint8_t value);
+};
+
+/**
+ * @brief Thrown by wdt_enable() to emulate the watchdog reset
+ */
+struct HostWatchdogReset
+{
+};
+
+extern uint64_t host_time_us;            ///< Virtual time advanced by _delay_us()/_delay_ms()
+extern uint8_t host_sreg_i;              ///< Global interrupt enable flag (sei()/cli())
+extern uint8_t host_rx_data;             ///< Byte returned by the next UDR0 read
+extern void (*host_tx_hook)(uint8_t);    ///< Called for every byte written to UDR0
+extern void (*host_preempt_hook)();      ///< Called at every preemption point of shared state accesses
+extern void (*host_ddr_hook)(char port, uint8_t old_value, uint8_t new_value); ///< Called for every DDRx write
+
+/**
+ * @brief Preemption point, a simulator can run an interrupt here
+ */
+inline void host_preempt()
+{
+    if (host_preempt_hook)
+        host_preempt_hook();
+}
+
+/**
+ * @brief Reset every stubbed register to its power-on value
+ *
+ * @details The stand-in RAM above host_ram_heap_top is painted again, as the
+ * MemMonitor does from .init3 on every boot.
+ */
+void host_reset_registers();
+
+#define HOST_RAM_SIZE 2048 // Size of the stand-in RAM read by the MemMonitor
+#define HOST_RAM_PAINT 0xC5 // Paint of the stand-in RAM, the MEM_CANARY of the MemMonitor
+
+extern uint8_t host_ram[HOST_RAM_SIZE]; ///< Stand-in RAM, the stack grows down from its end
+extern uint16_t host_ram_heap_top;      ///< Heap top in the stand-in RAM, the data below it is modelled as used
+
+/**
+ * @brief Mark the stand-in RAM as written by the stack
+ *
+ * @details A harness calls this with the stack depths it measures, so the
+ * MemMonitor finds the deepest one as the stack low-water mark.
+ *
+ * @param bytes Stack depth below the end of the stand-in RAM
+ */
+void host_ram_use(uint32_t bytes);
+
+#define HOST_F_CPU 16000000UL // Clock of the emulated ATmega328P
+
+/**
+ * @brief Decode the clock select bits CSn2:0 of Timer0 or Timer1
+ *
+ * @return Prescaler, 0 when the timer is stopped or clocked externally
+ */
+uint32_t host_timer_prescaler(uint8_t tccrb);
+
+/**
+ * @brief Restart the emulated Timer1 at the current virtual time
+ */
+void host_timer1_start();
+
+/**
+ * @brief Advance TCNT1 to the virtual time
+ *
+ * @details An overflow calls TIMER1_OVF_vect() when it is enabled and interrupts
+ * are on, otherwise it raises TOV1. A compare match B calls TIMER1_COMPB_vect(), if
+ * the program defines it, or raises OCF1B in the same way. Overflows and compare
+ * matches are handled in time order. The counting continues from the current
+ * TCNT1 with the current prescaler, so both may be changed by the program; the
+ * cycles since the previous call count with the new prescaler.
+ */
+void host_timer1_sync();
+
+/**
+ * @brief Tell whether a Timer0 compare match starts a conversion
+ *
+ * @details A compare match only starts a conversion of the enabled ADC while its
+ * auto trigger is on. The conversion clears a pending ADSC.
+ *
+ * @return 1 if the harness delivers a sample through ADC_vect()
+ */
+char host_adc_triggered();
+
+/**
+ * @brief Complete a single conversion started by setting ADSC
+ *
+ * @details Without the auto trigger a conversion only runs once the program sets
+ * ADSC. It takes about 104 us, so a harness completes it after the main loop
+ * iteration that started it. Nothing completes while interrupts are off.
+ *
+ * @return 1 if the harness delivers a sample through ADC_vect()
+ */
+char host_adc_single();
+
+// AVR libc conversions missing from glibc
+char *utoa(unsigned int val, char *s, int radix);
+char *itoa(int val, char *s, int radix);
+char *ultoa(unsigned long val, char *s, int radix);
+
+// Port B, C, D
+extern HostDdr DDRB, DDRC, DDRD;
+extern volatile uint8_t PORTB, PINB;
+extern volatile uint8_t PORTC, PINC;
+extern volatile uint8_t PORTD, PIND;
+
+// ADC
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern volatile uint16_t ADC;
+#define ADCW ADC
+
+// Timer/Counter0
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0;
+extern HostFlags TIFR0;
+
+// Timer/Counter1
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+extern HostFlags TIFR1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+
+// Timer/Counter2
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2;
+extern HostFlags TIFR2;
+
+// External and pin change interrupts
+extern volatile uint8_t EICRA, EIMSK, EIFR, PCICR, PCMSK0, PCMSK1, PCMSK2;
+extern HostFlags PCIFR;
+
+// USART0
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+extern HostUdr UDR0;
+
+// Status register, stack pointer and reset status
+extern HostSreg SREG;
+extern volatile uint8_t MCUSR;
+extern volatile uint16_t SP;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+#define PORTD0 0
+#define PORTD1 1
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD6 6
+#define PORTD7 7
+
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+
+#define WGM00 0
+#define WGM01 1
+#define WGM02 3
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+
+#define WGM20 0
+#define WGM21 1
+#define WGM22 3
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define INT0 0
+#define INT1 1
+#define INTF0 0
+#define INTF1 1
+
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+#define PCINT16 0
+#define PCINT17 1
+#define PCINT18 2
+#define PCINT19 3
+#define PCINT20 4
+#define PCINT21 5
+#define PCINT22 6
+#define PCINT23 7
+
+#define MPCM0 0
+#define U2X0 1
+#define UPE0 2
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+
+#define TXB80 0
+#define RXB80 1
+#define UCSZ02 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+#define USBS0 3
+#define UPM00 4
+#define UPM01 5
+
+#define SREG_I 7
@@ -0,0 +1,120 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * Build variants, selected by a build flag of the PlatformIO environment:
+ *  - FEATURES_MINIMAL: the bare volume knob, handshake, reports, display and mute
+ *  - FEATURES_PRODUCTION: the user facing features, no test and diagnostic tools
+ *  - FEATURES_INSTRUMENTED: everything and the sampling profiler
+ *  - none: everything but the profiler, which changes the timing of the firmware
+ * Every FEATURE_* can also be set on its own with -DFEATURE_<NAME>=0 or 1.
+ */
+#if defined(FEATURES_MINIMAL)
+#define FEATURE_USER 0
+#define FEATURE_TOOLS 0
+#define FEATURE_INSTRUMENTS 0
+#elif defined(FEATURES_PRODUCTION)
+#define FEATURE_USER 1
+#define FEATURE_TOOLS 0
+#define FEATURE_INSTRUMENTS 0
+#elif defined(FEATURES_INSTRUMENTED)
+#define FEATURE_USER 1
+#define FEATURE_TOOLS 1
+#define FEATURE_INSTRUMENTS 1
+#else
+#define FEATURE_USER 1
+#define FEATURE_TOOLS 1
+#define FEATURE_INSTRUMENTS 0
+#endif
+
+// Serial
+#ifndef FEATURE_STAMPS
+#define FEATURE_STAMPS FEATURE_USER // Stamped report format ('t') with sequence numbers and time
+#endif
+#ifndef FEATURE_STEP_TRACKING
+#define FEATURE_STEP_TRACKING FEATURE_USER // Low-latency step tracking mode of the median filter ('f')
+#endif
+#ifndef FEATURE_CURVES
+#define FEATURE_CURVES FEATURE_USER // Volume curves selected by the 'v' handshake
+#endif
+
+#ifndef FEATURE_FLOW_CONTROL
+#define FEATURE_FLOW_CONTROL 1 // XON/XOFF flow control of the received bytes, in every variant
+#endif
+
+// TM1637
+#ifndef FEATURE_DISPLAY_TEXT
+#define FEATURE_DISPLAY_TEXT FEATURE_USER // Full 7-segment font, without it only digits and the fixed patterns
+#endif
+
+// Main loop
+#ifndef FEATURE_KEYS
+#define FEATURE_KEYS FEATURE_USER // Media keys on the pin change interrupt
+#endif
+#ifndef FEATURE_NOISE_TUNING
+#define FEATURE_NOISE_TUNING FEATURE_USER // Median filter tuned to the measured noise ('n')
+#endif
+#ifndef FEATURE_LOCAL_DISPLAY
+#define FEATURE_LOCAL_DISPLAY FEATURE_USER // Volume rendered by the device ('l')
+#endif
+#ifndef FEATURE_DIAGNOSTICS
+#define FEATURE_DIAGNOSTICS FEATURE_TOOLS // RAM budget ('m') and ping ('p')
+#endif
+#ifndef FEATURE_CAPTURE
+#define FEATURE_CAPTURE FEATURE_TOOLS // Raw ADC capture mode ('c')
+#endif
+#ifndef FEATURE_SIGNAL_GEN
+#define FEATURE_SIGNAL_GEN FEATURE_TOOLS // Signal generator in place of the ADC ('g')
+#endif
+#ifndef FEATURE_BENCH
+#define FEATURE_BENCH FEATURE_TOOLS // On-target microbenchmarks ('b')
+#endif
+#ifndef FEATURE_PROFILING
+#define FEATURE_PROFILING FEATURE_INSTRUMENTS // Timer2 sampling profiler ('h')
+#endif
+
+/**
+ * @brief Compile-time feature switches
+ *
+ * @details The code tests the switches with if constexpr or as the first operand
+ * of a condition, so a disabled feature is still compiled and type checked, but
+ * the condition folds to false and generates no code, and its functions,
+ * tables and objects are dropped by the linker (-ffunction-sections,
+ * -fdata-sections and --gc-sections of the AVR builds). The feature objects have
+ * constexpr constructors, so no startup code keeps them. Only interrupt vectors,
+ * which the vector table always references, are left out with the preprocessor.
+ */
+struct Features
+{
+    static constexpr bool stamps = FEATURE_STAMPS;
+    static constexpr bool step_tracking = FEATURE_STEP_TRACKING;
+    static constexpr bool curves = FEATURE_CURVES;
+    static constexpr bool flow_control = FEATURE_FLOW_CONTROL;
+    static constexpr bool display_text = FEATURE_DISPLAY_TEXT;
+    static constexpr bool keys = FEATURE_KEYS;
+    static constexpr bool noise_tuning = FEATURE_NOISE_TUNING;
+    static constexpr bool local_display = FEATURE_LOCAL_DISPLAY;
+    static constexpr bool diagnostics = FEATURE_DIAGNOSTICS;
+    static constexpr bool capture = FEATURE_CAPTURE;
+    static constexpr bool signal_gen = FEATURE_SIGNAL_GEN;
+    static constexpr bool bench = FEATURE_BENCH;
+    static constexpr bool profiling = FEATURE_PROFILING;
+};
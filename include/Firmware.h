@@ -0,0 +1,102 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "Features.h"
+#include "Serial.h"
+#include "TM1637.h"
+#include "AdcCapture.h"
+#include "Shared.h"
+#include "SignalGen.h"
+#include "Keys.h"
+#include "NoiseTuner.h"
+
+#ifndef SERIAL_BAUDRATE
+#define SERIAL_BAUDRATE 57600UL // Baud rate passed to Serial (doubled by DOUBLE_SPEED)
+#endif
+#define MEDIAN_FILTER_SIZE 21 // Size of the median filter
+#define SENDING_BIAS 1 // Minimal change of the median to send a new value
+#ifndef DOUBLE_SPEED
+#define DOUBLE_SPEED 1 // USART double speed mode
+#endif
+#define SAMPLE_PERIOD 156 // OCR0A for ~10ms sampling
+#define IDLE_SAMPLE_US 100000UL // Period of the conversions started by the main loop while the knob is still
+#define IDLE_AFTER_SAMPLES 100 // Samples without a report before switching to the idle rate
+#define TUNE_WINDOW_MIN 5 // Smallest median window of the tuner, the largest is MEDIAN_FILTER_SIZE
+#define TUNE_BIAS_MAX 8 // Largest sending bias of the tuner, the smallest is SENDING_BIAS
+#define ACTIVITY_DEADBAND 8 // Change of a sample against the last sent value that wakes the full rate
+#define LINE_BAUDRATE (SERIAL_BAUDRATE * (DOUBLE_SPEED ? 2 : 1)) // Effective baud rate of the line
+#define PING_TOKEN_MAX 8 // Max length of the token echoed by a ping
+#define COMMAND_LINE_MAX 24 // Max length of the arguments of a line command
+#define SIGNAL_SOURCE SIGNAL_ADC // Input source selected at boot
+#define LOCAL_DISPLAY 0 // 1 renders the volume on the display at boot instead of the host
+#define DISPLAY_OVERRIDE_US 2000000UL // Time a host line overrides the local display
+#define RESUME_BYTE 0x18 // ASCII CAN, resumes the session from any parser state
+#define BENCH_RUNS 8 // Runs of each microbenchmark case
+#define BENCH_DISPLAY_RUNS 2 // Runs of the display frame case, a frame takes ~22 ms
+#define KEY_PLAY PD3 // Play/pause key, PCINT19
+#define KEY_NEXT PD4 // Next track key, PCINT20
+#define KEY_PREVIOUS PD7 // Previous track key, PCINT23
+
+/**
+ * @brief Volume display, CLK on PD5 and DIO on PD6
+ */
+typedef TM1637<TM1637PortD, PORTD5, PORTD6> VolumeDisplay;
+
+/**
+ * @brief States of the main loop
+ */
+enum MainState : uint8_t
+{
+    STATE_HANDSHAKE, ///< Waiting for the 'w' handshake from the host
+    STATE_FIRST_VALUE, ///< Waiting for the first valid ADC value
+    STATE_RUNNING ///< Normal operation
+};
+
+extern Mailbox<uint16_t> adc_mailbox;
+extern Mailbox<char> mute_mailbox;
+
+extern Serial serial;
+extern VolumeDisplay display;
+extern TM1637Scheduler display_bus;
+extern AdcCapture capture;
+extern SignalGen signal_gen;
+extern Keys keys;
+extern NoiseTuner tuner;
+extern MainState main_state;
+
+/**
+ * @brief Function to initialize the firmware
+ * 
+ * @details This function resets the main loop state, prints the initialization
+ * pattern, initializes pins and peripherals and enables global interrupts.
+ * The main loop then starts in the handshake state.
+ */
+void firmware_init();
+
+/**
+ * @brief Function to run one iteration of the main loop
+ * 
+ * @details This function never blocks on input. Depending on the main loop state
+ * it waits for the handshake, for the first ADC value, or handles mute/unmute,
+ * ADC values and received bytes. The host replay harness calls it directly.
+ */
+void firmware_poll();
@@ -0,0 +1,98 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "AdcCapture.h"
+
+// Function to calculate the sustainable sample rate
+uint32_t AdcCapture::sustainableRate(uint32_t line_baud)
+{
+    // 10 bits per byte (start, 8 data, stop), 2 bytes per sample plus the frame overhead
+    return line_baud / 10 * CAPTURE_BLOCK / (2 * CAPTURE_BLOCK + CAPTURE_OVERHEAD);
+}
+
+// Function to start the capture mode
+void AdcCapture::start(Serial &serial, uint32_t line_baud)
+{
+    uint32_t sustainable = sustainableRate(line_baud);
+    uint32_t rate_decimation = (CAPTURE_ADC_RATE + sustainable - 1) / sustainable;
+    decimation = (rate_decimation > 255) ? 255 : (uint8_t)rate_decimation;
+
+    // Report the streamed and the sustainable sample rate
+    serial.sendChar('c');
+    serial.sendNum(CAPTURE_ADC_RATE / decimation);
+    serial.sendChar(',');
+    serial.sendNum(sustainable);
+    serial.sendChar('\n');
+
+    // Reset the buffers before the ADC interrupt starts filling them
+    ready[0] = 0;
+    ready[1] = 0;
+    fill_buffer = 0;
+    fill_pos = 0;
+    dropping = 0;
+    seq = 0;
+    decimation_count = 0;
+    send_buffer = 0;
+    active = 1;
+
+    // Free running mode, start the first conversion
+    ADCSRB &= ~((1 << ADTS2) | (1 << ADTS1) | (1 << ADTS0));
+    ADCSRA |= (1 << ADSC);
+}
+
+// Function to stop the capture mode
+void AdcCapture::stop(Serial &serial)
+{
+    // Set Timer/Counter0 Compare Match A as trigger source again
+    ADCSRB = (1 << ADTS1) | (1 << ADTS0);
+    active = 0;
+
+    // Flush full blocks and send the end frame
+    service(serial);
+    service(serial);
+    sendFrame(serial, seq, buffers[0], 0);
+}
+
+// Function to send full blocks
+void AdcCapture::service(Serial &serial)
+{
+    if (!ready[send_buffer])
+        return;
+    sendFrame(serial, block_seq[send_buffer], buffers[send_buffer], CAPTURE_BLOCK);
+    // Release the buffer for the ADC interrupt
+    ready[send_buffer] = 0;
+    send_buffer ^= 1;
+}
+
+// Function to send a block frame
+void AdcCapture::sendFrame(Serial &serial, uint8_t frame_seq, const volatile uint16_t *samples, uint8_t length)
+{
+    // A flow byte inside the frame would be taken for a sample
+    serial.holdFlow(1);
+    serial.sendChar(CAPTURE_SYNC);
+    serial.sendChar(frame_seq);
+    serial.sendChar(length * 2);
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        uint16_t sample = samples[i];
+        serial.sendChar(sample & 0xFF);
+        serial.sendChar(sample >> 8);
+    }
+    serial.holdFlow(0);
+}
@@ -0,0 +1,174 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <avr/io.h>
+#include <stdint.h>
+#include "Serial.h"
+
+#define CAPTURE_BLOCK 32 // Number of samples in one captured block
+#define CAPTURE_SYNC 0xA5 // First byte of every block frame
+#define CAPTURE_OVERHEAD 3 // Frame bytes besides the samples (sync, sequence number, length)
+#define CAPTURE_ADC_RATE (FOSC / 128 / 13) // Free running ADC sample rate with prescaler 128
+
+#if CAPTURE_OVERHEAD + 2 * CAPTURE_BLOCK > RX_FLOW_HOLD_MAX
+#error "A capture frame is longer than the flow control of Serial allows"
+#endif
+
+/**
+ * @brief Raw ADC capture class
+ * 
+ * @details In capture mode the ADC runs free instead of being triggered by Timer0.
+ * The ADC interrupt stores every sample (or every n-th sample when the line is too
+ * slow) into one of two ping-pong buffers, while the main loop sends the other full
+ * buffer as a binary frame:
+ * 
+ * | 0xA5 | sequence number | payload length | payload (little endian uint16_t samples) |
+ * 
+ * The sequence number is incremented for every block, including blocks that were
+ * dropped because the main loop was not done sending, so the host can detect gaps.
+ * A frame with zero payload length ends the capture. The XON and XOFF bytes of the
+ * flow control are only sent between frames.
+ */
+class AdcCapture
+{
+    // Ping-pong sample buffers
+    volatile uint16_t buffers[2][CAPTURE_BLOCK] = {};
+    // Buffer full and waiting to be sent flags
+    volatile char ready[2] = {0, 0};
+    // Sequence numbers of the full buffers
+    volatile uint8_t block_seq[2] = {0, 0};
+    // Buffer filled by the ADC interrupt
+    volatile uint8_t fill_buffer = 0;
+    // Position in the filled buffer
+    volatile uint8_t fill_pos = 0;
+    // Current block is dropped flag
+    volatile char dropping = 0;
+    // Sequence number of the current block
+    volatile uint8_t seq = 0;
+    // Only every decimation-th sample is stored
+    uint8_t decimation = 1;
+    // Counter for the decimation
+    volatile uint8_t decimation_count = 0;
+    // Buffer to be sent next
+    uint8_t send_buffer = 0;
+    // Capture mode active flag
+    volatile char active = 0;
+
+    /**
+     * @brief Function to send a block frame
+     * 
+     * @param serial Serial used to send the frame
+     * @param frame_seq Sequence number of the block
+     * @param samples Samples to send
+     * @param length Number of samples
+     */
+    void sendFrame(Serial &serial, uint8_t frame_seq, const volatile uint16_t *samples, uint8_t length);
+
+public:
+    /**
+     * @brief Constructor, a constant initialization that needs no startup code
+     */
+    constexpr AdcCapture() = default;
+
+    /**
+     * @brief Function to calculate the sustainable sample rate
+     * 
+     * @details This function calculates how many samples per second can be streamed
+     * at the given line baud rate, including the frame overhead of every block.
+     * 
+     * @param line_baud Effective baud rate of the line (doubled in double speed mode)
+     * @return uint32_t Sustainable sample rate in samples per second
+     */
+    static uint32_t sustainableRate(uint32_t line_baud);
+
+    /**
+     * @brief Function to start the capture mode
+     * 
+     * @details This function chooses the smallest decimation that fits the
+     * sustainable sample rate, reports "c<sample rate>,<sustainable rate>\n" and
+     * switches the ADC to free running mode.
+     * 
+     * @param serial Serial used to send the report
+     * @param line_baud Effective baud rate of the line (doubled in double speed mode)
+     */
+    void start(Serial &serial, uint32_t line_baud);
+
+    /**
+     * @brief Function to stop the capture mode
+     * 
+     * @details This function switches the ADC back to the Timer0 trigger, discards
+     * the partially filled block and sends the empty end frame.
+     * 
+     * @param serial Serial used to send the end frame
+     */
+    void stop(Serial &serial);
+
+    /**
+     * @brief Function to send full blocks
+     * 
+     * @details This function sends the next full buffer, if any, and releases it
+     * for the ADC interrupt. It must be called from the main loop.
+     * 
+     * @param serial Serial used to send the frame
+     */
+    void service(Serial &serial);
+
+    /**
+     * @brief Function to check if the capture mode is active
+     * 
+     * @return char 1 if the capture mode is active, 0 otherwise
+     */
+    char isActive() const
+    {
+        return active;
+    }
+
+    /**
+     * @brief Function to store a sample, called from the ADC interrupt
+     * 
+     * @details Whether a block is stored or dropped is decided at its first sample,
+     * so a stored block always contains consecutive samples.
+     * 
+     * @param sample ADC sample
+     */
+    inline void push(uint16_t sample)
+    {
+        if (++decimation_count < decimation)
+            return;
+        decimation_count = 0;
+
+        if (fill_pos == 0)
+            dropping = ready[fill_buffer];
+        if (!dropping)
+            buffers[fill_buffer][fill_pos] = sample;
+        if (++fill_pos == CAPTURE_BLOCK)
+        {
+            fill_pos = 0;
+            if (!dropping)
+            {
+                block_seq[fill_buffer] = seq;
+                ready[fill_buffer] = 1;
+                fill_buffer ^= 1;
+            }
+            seq++;
+        }
+    }
+};
@@ -0,0 +1,64 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Clock.h"
+
+// Number of Timer1 overflows
+volatile uint16_t Clock::overflows = 0;
+
+// Function to start the clock
+void Clock::init()
+{
+    // Normal mode, prescaler 64
+    TCCR1A = 0;
+    TCCR1B = (1 << CS11) | (1 << CS10);
+    TCNT1 = 0;
+    overflows = 0;
+    // Clear a pending overflow and enable the overflow interrupt
+    TIFR1 = (1 << TOV1);
+    TIMSK1 |= (1 << TOIE1);
+}
+
+// Function to read the current time
+uint32_t Clock::micros()
+{
+    return ticks() * CLOCK_US_PER_TICK;
+}
+
+// Function to read the extended Timer1 count
+uint32_t Clock::ticks()
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t count = TCNT1;
+    uint16_t high = overflows;
+    // The counter overflowed after the interrupts were disabled
+    if ((TIFR1 & (1 << TOV1)) && count < 0x8000)
+    {
+        high++;
+    }
+    SREG = sreg;
+    return ((uint32_t)high << 16) | count;
+}
+
+// Interrupt service routine for Timer1 overflow
+ISR(TIMER1_OVF_vect)
+{
+    Clock::overflows++;
+}
@@ -0,0 +1,73 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#define CLOCK_PRESCALER 64 // Timer1 prescaler, one tick is 4us at 16 MHz
+#define CLOCK_US_PER_TICK 4 // Microseconds per Timer1 tick
+
+/**
+ * @brief Free-running device clock
+ * 
+ * @details Timer1 runs freely with prescaler 64 and its overflow interrupt extends
+ * the 16-bit counter to 32 bits, so timestamps have a resolution of 4us and wrap
+ * after about 71 minutes.
+ */
+class Clock
+{
+public:
+    // Number of Timer1 overflows, incremented by the overflow interrupt
+    static volatile uint16_t overflows;
+
+    /**
+     * @brief Function to start the clock
+     * 
+     * @details This function sets Timer1 to normal mode with prescaler 64 and enables
+     * the overflow interrupt.
+     */
+    static void init();
+
+    /**
+     * @brief Function to read the current time
+     * 
+     * @details This function combines the overflow count and the counter with
+     * interrupts disabled and accounts for an overflow that is pending but not yet
+     * handled.
+     * 
+     * @return uint32_t Microseconds since init()
+     */
+    static uint32_t micros();
+
+    /**
+     * @brief Function to read the extended Timer1 count
+     * 
+     * @details This function reads the count like micros() without the scaling, so
+     * it counts CPU cycles while Timer1 runs without a prescaler.
+     * 
+     * @return uint32_t Timer1 ticks since the last restart of the count
+     */
+    static uint32_t ticks();
+};
+
+// Interrupt service routine for Timer1 overflow
+ISR(TIMER1_OVF_vect);
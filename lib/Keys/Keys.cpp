@@ -0,0 +1,100 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <avr/interrupt.h>
+#include "Keys.h"
+
+// Function to set up the key pins and the pin change interrupt
+void Keys::init(const uint8_t *pins, uint8_t number)
+{
+    count = (number > KEYS_MAX) ? KEYS_MAX : number;
+    mask = 0;
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        pin_mask[i] = 1 << pins[i];
+        mask |= pin_mask[i];
+    }
+    // Inputs with pull-ups, a pressed key reads 0
+    DDRD &= ~mask;
+    PORTD |= mask;
+    stable = PIND & mask;
+    bouncing = 0;
+    head = 0;
+    tail = 0;
+    dropped = 0;
+    TIMSK1 &= ~(1 << OCIE1B);
+    PCMSK2 |= mask;
+    PCIFR = (1 << PCIF2);
+    PCICR |= (1 << PCIE2);
+}
+
+// Function to queue an event
+void Keys::post(uint8_t code, uint32_t time)
+{
+    uint8_t next = (head + 1) & (KEYS_QUEUE_SIZE - 1);
+    if (next == tail)
+    {
+        dropped++;
+        return;
+    }
+    events[head].code = code;
+    events[head].time = time;
+    head = next;
+}
+
+// Function to accept the settled levels
+void Keys::onDebounce()
+{
+    TIMSK1 &= ~(1 << OCIE1B);
+    uint8_t levels = PIND & mask;
+    uint8_t changed = (levels ^ stable) & bouncing;
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        // A key that bounced back to its accepted level produces no event
+        if (changed & pin_mask[i])
+            post(i | ((levels & pin_mask[i]) ? 0 : KEY_PRESSED), first_edge[i]);
+    }
+    stable = (stable & ~bouncing) | (levels & bouncing);
+    bouncing = 0;
+}
+
+// Function to take the oldest key event
+char Keys::take(KeyEvent &event)
+{
+    if (tail == head)
+        return 0;
+    event = events[tail];
+    tail = (tail + 1) & (KEYS_QUEUE_SIZE - 1);
+    return 1;
+}
+
+// Function to send a key event over serial
+void Keys::send(Serial &serial, const KeyEvent &event)
+{
+    serial.sendChar('k');
+    serial.sendChar('0' + (event.code & ~KEY_PRESSED));
+    serial.sendChar(',');
+    serial.sendChar((event.code & KEY_PRESSED) ? '1' : '0');
+    if (serial.isStamped())
+    {
+        serial.sendChar(',');
+        serial.sendNum(event.time);
+    }
+    serial.sendChar('\n');
+}
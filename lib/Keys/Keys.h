@@ -0,0 +1,159 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <avr/io.h>
+#include <stdint.h>
+#include "Clock.h"
+#include "Serial.h"
+
+#define KEYS_MAX 4 // Maximum number of keys
+#define KEYS_DEBOUNCE_US 20000UL // Time the pins must be quiet before a change is accepted
+#define KEYS_QUEUE_SIZE 8 // Number of queued key events, a power of two
+#define KEY_PRESSED 0x80 // Flag of a key event for a pressed key
+
+/**
+ * @brief Debounced key event
+ */
+struct KeyEvent
+{
+    uint8_t code; ///< Key index, KEY_PRESSED is set for a press
+    uint32_t time; ///< Device time of the first edge of the change
+};
+
+/**
+ * @brief Key input on the pin change interrupt of port D
+ *
+ * @details The keys pull their pins of port D low against the internal pull-ups.
+ * The pin change interrupt only stamps the first edge of a bounce burst and
+ * (re)schedules the Timer1 compare match B KEYS_DEBOUNCE_US ahead, so every
+ * further edge pushes the decision back. When the compare match fires the pins
+ * have been quiet for the debounce time, and every key whose level differs from
+ * its last accepted level becomes one event with the time of its first edge.
+ *
+ * Neither interrupt polls or waits, and the main loop sends the queued events
+ * only in iterations without an ADC value, so the keys never delay a report.
+ * Timer1 keeps running freely for the clock, the compare match only reads it.
+ */
+class Keys
+{
+    uint8_t pin_mask[KEYS_MAX] = {}; ///< PIND mask of each key
+    uint8_t count = 0; ///< Number of keys
+    uint8_t mask = 0; ///< PIND mask of all keys
+    uint8_t stable = 0; ///< Last accepted pin levels
+    uint8_t bouncing = 0; ///< Pins that changed since the last accepted levels
+    uint32_t first_edge[KEYS_MAX] = {}; ///< Time of the first edge of each bouncing key
+
+    // Event queue, the compare match interrupt is the only writer
+    KeyEvent events[KEYS_QUEUE_SIZE] = {};
+    volatile uint8_t head = 0;
+    volatile uint8_t tail = 0;
+    volatile uint8_t dropped = 0;
+
+    /**
+     * @brief Function to queue an event, called from the compare match interrupt
+     *
+     * @param code Key index, KEY_PRESSED is set for a press
+     * @param time Time of the first edge
+     */
+    void post(uint8_t code, uint32_t time);
+
+public:
+    /**
+     * @brief Constructor, a constant initialization that needs no startup code
+     */
+    constexpr Keys() = default;
+
+    /**
+     * @brief Function to set up the key pins and the pin change interrupt
+     *
+     * @details This function sets the pins as inputs with pull-ups, accepts their
+     * current levels and enables PCINT2 for them. The interrupts must be disabled.
+     *
+     * @param pins Bits of port D of the keys, the index is the key number
+     * @param number Number of keys, at most KEYS_MAX
+     */
+    void init(const uint8_t *pins, uint8_t number);
+
+    /**
+     * @brief Function to handle a pin change, called from the PCINT2 interrupt
+     */
+    inline void onPinChange()
+    {
+        uint8_t changed = (PIND ^ stable) & mask & ~bouncing;
+        if (changed)
+        {
+            uint32_t now = Clock::micros();
+            for (uint8_t i = 0; i < count; ++i)
+            {
+                if (changed & pin_mask[i])
+                    first_edge[i] = now;
+            }
+            bouncing |= changed;
+        }
+        // Restart the debounce time, also on the edges of a bouncing key
+        OCR1B = TCNT1 + (uint16_t)(KEYS_DEBOUNCE_US / CLOCK_US_PER_TICK);
+        TIFR1 = (1 << OCF1B);
+        TIMSK1 |= (1 << OCIE1B);
+    }
+
+    /**
+     * @brief Function to accept the settled levels, called from the compare match interrupt
+     */
+    void onDebounce();
+
+    /**
+     * @brief Function to take the oldest key event
+     *
+     * @param event Taken event
+     * @return char 1 if an event was taken, 0 if the queue is empty
+     */
+    char take(KeyEvent &event);
+
+    /**
+     * @brief Function to discard the queued key events
+     */
+    void flush()
+    {
+        tail = head;
+    }
+
+    /**
+     * @brief Function to get the number of events lost to a full queue
+     *
+     * @return uint8_t Number of dropped events
+     */
+    uint8_t droppedEvents() const
+    {
+        return dropped;
+    }
+
+    /**
+     * @brief Function to send a key event over serial
+     *
+     * @details This function sends "k<key>,<state>\n", where state is 1 for a press
+     * and 0 for a release. In timestamped mode ",<time>" with the device time of
+     * the first edge in microseconds precedes the newline.
+     *
+     * @param serial Serial used to send the event
+     * @param event Key event
+     */
+    static void send(Serial &serial, const KeyEvent &event);
+};
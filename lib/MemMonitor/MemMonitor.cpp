@@ -0,0 +1,114 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "MemMonitor.h"
+
+#ifdef HOST_BUILD
+// Stand-in RAM of the host stub, painted on every reset and marked by the harness
+static_assert(HOST_RAM_PAINT == MEM_CANARY, "the host stub paints with another canary");
+#define RAM_HEAP_START ((uintptr_t)0)
+#define RAM_END ((uintptr_t)(HOST_RAM_SIZE - 1))
+#define RAM_HEAP_TOP ((uintptr_t)host_ram_heap_top)
+#define RAM_STACK_POINTER RAM_END
+#define RAM_BYTE(address) (host_ram[address])
+#define RAM_ADDRESS(address) ((uint16_t)(address))
+#else
+extern uint8_t _end; // End of .bss, start of the heap
+extern uint8_t __stack; // Top of the RAM
+extern char *__brkval; // Heap top, 0 before the first allocation
+
+#define RAM_HEAP_START ((uintptr_t)&_end)
+#define RAM_END ((uintptr_t)&__stack)
+#define RAM_HEAP_TOP (__brkval ? (uintptr_t)__brkval : RAM_HEAP_START)
+#define RAM_STACK_POINTER ((uintptr_t)SP)
+#define RAM_BYTE(address) (*(const volatile uint8_t *)(address))
+#define RAM_ADDRESS(address) ((uint16_t)(address))
+
+// Function to paint the free RAM, runs from .init3 before main and all constructors
+void MemMonitor_paint(void) __attribute__((naked, used, section(".init3")));
+void MemMonitor_paint(void)
+{
+    // Written in assembly, as no stack frame may be used while the stack is painted
+    __asm volatile("    ldi r30, lo8(_end)\n"
+                   "    ldi r31, hi8(_end)\n"
+                   "    ldi r24, %0\n"
+                   "    ldi r25, hi8(__stack)\n"
+                   "    rjmp 2f\n"
+                   "1:  st Z+, r24\n"
+                   "2:  cpi r30, lo8(__stack)\n"
+                   "    cpc r31, r25\n"
+                   "    brlo 1b\n"
+                   "    breq 1b\n"
+                   :
+                   : "i"(MEM_CANARY));
+}
+#endif
+
+// Function to get the current heap top
+uint16_t MemMonitor::heapTop()
+{
+    return RAM_ADDRESS(RAM_HEAP_TOP);
+}
+
+// Function to get the stack low-water mark
+uint16_t MemMonitor::stackLowWater()
+{
+    uintptr_t address = RAM_HEAP_TOP;
+    while (address < RAM_END && RAM_BYTE(address) == MEM_CANARY)
+    {
+        address++;
+    }
+    return RAM_ADDRESS(address);
+}
+
+// Function to get the currently free RAM
+uint16_t MemMonitor::freeNow()
+{
+    return RAM_ADDRESS(RAM_STACK_POINTER) - heapTop();
+}
+
+// Function to get the smallest margin seen so far
+uint16_t MemMonitor::margin()
+{
+    return stackLowWater() - heapTop();
+}
+
+// Function to check the margin against MEM_MARGIN_MIN
+char MemMonitor::marginOk()
+{
+    return margin() >= MEM_MARGIN_MIN;
+}
+
+// Function to report the memory usage over serial
+void MemMonitor::report(Serial &serial)
+{
+    uint16_t heap_top = heapTop();
+    uint16_t stack_low = stackLowWater();
+    serial.sendChar('m');
+    serial.sendNum(stack_low - heap_top);
+    serial.sendChar(',');
+    serial.sendNum(freeNow());
+    serial.sendChar(',');
+    serial.sendNum(heap_top);
+    serial.sendChar(',');
+    serial.sendNum(stack_low);
+    serial.sendChar(',');
+    serial.sendNum(stack_low - heap_top >= MEM_MARGIN_MIN);
+    serial.sendChar('\n');
+}
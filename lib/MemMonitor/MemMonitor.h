@@ -0,0 +1,92 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "Serial.h"
+
+#define MEM_CANARY 0xC5 // Value painted into the free RAM at boot
+#define MEM_MARGIN_MIN 128 // Smallest acceptable untouched gap between heap and stack in bytes
+
+/**
+ * @brief RAM budget monitor class
+ * 
+ * @details At boot (section .init3, before the data and bss initialization and
+ * before any constructor allocates from the heap) the whole RAM between the end
+ * of .bss and the top of the stack is painted with MEM_CANARY. The deepest stack
+ * address ever used is then the first byte above the heap top that no longer
+ * holds the canary. The gap between the heap top and that address is the
+ * margin left before a stack/heap collision.
+ * 
+ * Host builds have no AVR memory map, there the monitor reads the stand-in RAM
+ * of the host stub (host_ram), which a simulator marks with the stack depths it
+ * measures.
+ */
+class MemMonitor
+{
+public:
+    /**
+     * @brief Function to get the current heap top
+     * 
+     * @return uint16_t Address of the first byte above the heap
+     */
+    static uint16_t heapTop();
+
+    /**
+     * @brief Function to get the stack low-water mark
+     * 
+     * @details This function scans the painted RAM upwards from the heap top
+     * for the first byte that was overwritten by the stack.
+     * 
+     * @return uint16_t Lowest address ever used by the stack
+     */
+    static uint16_t stackLowWater();
+
+    /**
+     * @brief Function to get the currently free RAM
+     * 
+     * @return uint16_t Number of bytes between the heap top and the stack pointer
+     */
+    static uint16_t freeNow();
+
+    /**
+     * @brief Function to get the smallest margin seen so far
+     * 
+     * @return uint16_t Number of never used bytes between the heap top and the stack
+     */
+    static uint16_t margin();
+
+    /**
+     * @brief Function to check the margin against MEM_MARGIN_MIN
+     * 
+     * @return char 1 if the margin is at least MEM_MARGIN_MIN, 0 otherwise
+     */
+    static char marginOk();
+
+    /**
+     * @brief Function to report the memory usage over serial
+     * 
+     * @details This function sends "m<margin>,<free>,<heap top>,<stack low-water>,<ok>\n",
+     * where ok is 0 if the margin dropped below MEM_MARGIN_MIN.
+     * 
+     * @param serial Serial used to send the report
+     */
+    static void report(Serial &serial);
+};
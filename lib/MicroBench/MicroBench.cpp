@@ -0,0 +1,76 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "MicroBench.h"
+
+uint32_t MicroBench::start_ticks = 0;
+uint16_t MicroBench::overhead = 0;
+
+// Function to switch Timer1 to counting cycles
+void MicroBench::begin()
+{
+    uint8_t sreg = SREG;
+    cli();
+    start_ticks = Clock::ticks();
+    // No prescaler, restart the extended count
+    TCCR1B = (1 << CS10);
+    TCNT1 = 0;
+    Clock::overflows = 0;
+    TIFR1 = (1 << TOV1);
+    SREG = sreg;
+
+    overhead = 0;
+    Result empty = measure(BENCH_OVERHEAD_RUNS, [] {});
+    overhead = (uint16_t)empty.min;
+}
+
+// Function to switch Timer1 back to the clock
+void MicroBench::end()
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t ticks = start_ticks + Clock::ticks() / CLOCK_PRESCALER;
+    TCCR1B = (1 << CS11) | (1 << CS10);
+    TCNT1 = (uint16_t)ticks;
+    Clock::overflows = (uint16_t)(ticks >> 16);
+    TIFR1 = (1 << TOV1);
+    SREG = sreg;
+}
+
+// Function to send the result of a case over serial
+void MicroBench::report(Serial &serial, char name, uint16_t parameter, uint8_t runs, const Result &result)
+{
+    char buffer[11]; // Max length of uint32_t is 10 digits
+    serial.sendChar('b');
+    serial.sendChar(name);
+    utoa(parameter, buffer, 10);
+    serial.sendString(buffer);
+    serial.sendChar(',');
+    utoa(runs, buffer, 10);
+    serial.sendString(buffer);
+    serial.sendChar(',');
+    ultoa(result.min, buffer, 10);
+    serial.sendString(buffer);
+    serial.sendChar(',');
+    ultoa(result.max, buffer, 10);
+    serial.sendString(buffer);
+    serial.sendChar('\n');
+}
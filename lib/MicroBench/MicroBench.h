@@ -0,0 +1,120 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "Clock.h"
+#include "Serial.h"
+
+#define BENCH_OVERHEAD_RUNS 8 // Empty measurements taken for the overhead
+
+/**
+ * @brief On-target microbenchmark timer
+ *
+ * @details Between begin() and end() Timer1 runs without a prescaler, so the
+ * extended count of the clock counts CPU cycles (62.5 ns at 16 MHz) and a case
+ * may run for up to 2^32 cycles. The overflow interrupt stays on, it costs about
+ * 0.1 % of the cycles of cases longer than 65536 cycles. end() switches Timer1
+ * back to prescaler 64 and advances the clock by the elapsed time, so device
+ * timestamps stay continuous. Other compare matches of Timer1 run 64 times too
+ * early during the benchmark.
+ *
+ * Every result is the minimum and maximum over the runs of a case, less the
+ * cost of an empty measurement.
+ */
+class MicroBench
+{
+    // Clock ticks at begin()
+    static uint32_t start_ticks;
+    // Cycles of an empty measurement
+    static uint16_t overhead;
+
+public:
+    /**
+     * @brief Result of one case
+     */
+    struct Result
+    {
+        uint32_t min; ///< Fewest cycles of a run
+        uint32_t max; ///< Most cycles of a run
+    };
+
+    /**
+     * @brief Function to switch Timer1 to counting cycles
+     *
+     * @details This function stores the clock, restarts Timer1 without a prescaler
+     * and measures the overhead of an empty measurement.
+     */
+    static void begin();
+
+    /**
+     * @brief Function to switch Timer1 back to the clock
+     */
+    static void end();
+
+    /**
+     * @brief Function to get the cycles of an empty measurement
+     *
+     * @return uint16_t Cycles subtracted from every run
+     */
+    static uint16_t overheadCycles()
+    {
+        return overhead;
+    }
+
+    /**
+     * @brief Function to time the runs of a case
+     *
+     * @param runs Number of runs
+     * @param function Case, called once per run
+     * @return Result Fewest and most cycles of a run
+     */
+    template <class Function>
+    static Result measure(uint8_t runs, Function function)
+    {
+        Result result = {0xFFFFFFFFUL, 0};
+        for (uint8_t i = 0; i < runs; ++i)
+        {
+            uint32_t start = Clock::ticks();
+            function();
+            uint32_t cycles = Clock::ticks() - start;
+            cycles = (cycles > overhead) ? cycles - overhead : 0;
+            if (cycles < result.min)
+                result.min = cycles;
+            if (cycles > result.max)
+                result.max = cycles;
+        }
+        return result;
+    }
+
+    /**
+     * @brief Function to send the result of a case over serial
+     *
+     * @details This function sends "b<case><parameter>,<runs>,<min>,<max>\n" with
+     * the cycles of the fastest and the slowest run.
+     *
+     * @param serial Serial used to send the result
+     * @param name Letter of the case
+     * @param parameter Size parameter of the case
+     * @param runs Number of runs
+     * @param result Result of measure()
+     */
+    static void report(Serial &serial, char name, uint16_t parameter, uint8_t runs, const Result &result);
+};
@@ -0,0 +1,162 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <avr/eeprom.h>
+#include "NoiseTuner.h"
+
+// Function to set the bounds and select the stored or the default filter
+void NoiseTuner::init(uint8_t min_window, uint8_t max_window, uint8_t min_bias, uint8_t max_bias, uint8_t default_window, uint8_t default_bias)
+{
+    window_min = (min_window > 1) ? (min_window - 1) | 1 : 1;
+    window_max = (max_window > window_min) ? (max_window - 1) | 1 : window_min;
+    bias_min = min_bias;
+    bias_max = (max_bias > min_bias) ? max_bias : min_bias;
+    count = 0;
+    noise = 0;
+    blocks = 0;
+    confirmations = 0;
+    if (!load())
+    {
+        window = (default_window < window_min) ? window_min : (default_window > window_max ? window_max : default_window);
+        bias = default_bias;
+    }
+}
+
+// Function to read the stored filter
+char NoiseTuner::load()
+{
+    uint8_t record[4];
+    eeprom_read_block(record, (const void *)TUNE_EEPROM_ADDRESS, sizeof(record));
+    if (record[0] != TUNE_MAGIC || record[3] != (uint8_t)~(record[0] ^ record[1] ^ record[2]))
+    {
+        return 0;
+    }
+    if (record[1] < window_min || record[1] > window_max || record[2] < bias_min || record[2] > bias_max)
+    {
+        // Stored with other bounds
+        return 0;
+    }
+    window = record[1];
+    bias = record[2];
+    return 1;
+}
+
+// Function to store the selected filter
+void NoiseTuner::store() const
+{
+    uint8_t record[4] = {TUNE_MAGIC, window, bias, 0};
+    record[3] = ~(record[0] ^ record[1] ^ record[2]);
+    // Only the changed bytes are written
+    eeprom_update_block(record, (void *)TUNE_EEPROM_ADDRESS, sizeof(record));
+}
+
+// Function to choose the filter for a noise level
+void NoiseTuner::choose(uint16_t sigma16, uint8_t &out_window, uint8_t &out_bias) const
+{
+    // The median deviates by 1.25 * sigma / sqrt(W) = (5 / 64) * sigma16 / sqrt(W),
+    // compare the squares: (TUNE_MARGIN * 5 * sigma16)^2 <= (64 * bias)^2 * W
+    uint64_t needed = (uint64_t)TUNE_MARGIN * 5 * sigma16;
+    needed *= needed;
+    for (uint8_t w = window_min; w <= window_max; w += 2)
+    {
+        for (uint8_t b = bias_min; b <= bias_max; ++b)
+        {
+            if ((uint64_t)(64 * b) * (64 * b) * w >= needed)
+            {
+                out_window = w;
+                out_bias = b;
+                return;
+            }
+        }
+    }
+    // Too noisy for the bounds, the heaviest filter
+    out_window = window_max;
+    out_bias = bias_max;
+}
+
+// Function to add a sample to the noise measurement
+char NoiseTuner::sample(uint16_t value)
+{
+    uint16_t distance = (value > first) ? value - first : first - value;
+    if (count == 0 || distance > TUNE_STILL_RANGE)
+    {
+        // Start a block, also after a knob move
+        first = value;
+        previous = value;
+        sum = 0;
+        count = 1;
+        return 0;
+    }
+    sum += (value > previous) ? value - previous : previous - value;
+    previous = value;
+    if (++count < TUNE_BLOCK)
+    {
+        return 0;
+    }
+    count = 0;
+    blocks++;
+
+    // The mean absolute difference of consecutive samples is 1.128 sigma
+    noise = (uint16_t)((uint32_t)sum * 16000UL / (1128UL * (TUNE_BLOCK - 1)));
+    uint8_t w;
+    uint8_t b;
+    choose(noise, w, b);
+    if (w == window && b == bias)
+    {
+        confirmations = 0;
+        return 0;
+    }
+    if (confirmations && w == candidate_window && b == candidate_bias)
+    {
+        confirmations++;
+    }
+    else
+    {
+        candidate_window = w;
+        candidate_bias = b;
+        confirmations = 1;
+    }
+    if (confirmations < TUNE_CONFIRM)
+    {
+        return 0;
+    }
+    confirmations = 0;
+    window = w;
+    bias = b;
+    store();
+    return 1;
+}
+
+// Function to report the selected filter over serial
+void NoiseTuner::report(Serial &serial) const
+{
+    char buffer[6]; // Max length of uint16_t is 5 digits
+    const uint16_t values[] = {window, bias, noise, blocks};
+    serial.sendChar('n');
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        if (i)
+        {
+            serial.sendChar(',');
+        }
+        utoa(values[i], buffer, 10);
+        serial.sendString(buffer);
+    }
+    serial.sendChar('\n');
+}
@@ -0,0 +1,153 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "Serial.h"
+
+#define TUNE_BLOCK 64 // Still samples of one noise measurement
+#define TUNE_STILL_RANGE 32 // Deviation from the first sample of a block that counts as a knob move
+#define TUNE_CONFIRM 3 // Blocks that must agree before the filter changes
+#define TUNE_MARGIN 5 // Bias in standard deviations of the median, 4 for the difference of two medians and 1 to spare
+#define TUNE_EEPROM_ADDRESS 0 // EEPROM address of the stored filter
+#define TUNE_MAGIC 0x4E // Marker of a stored filter ('N')
+
+/**
+ * @brief Online noise estimator tuning the median filter
+ *
+ * @details While the knob is still, the tuner sums the absolute differences of
+ * consecutive samples over a block of TUNE_BLOCK samples. For Gaussian noise the
+ * mean absolute difference is 2/sqrt(pi) = 1.128 times the standard deviation,
+ * and unlike the variance it is not blown up by a single outlier. A sample more
+ * than TUNE_STILL_RANGE away from the first sample of the block restarts it.
+ *
+ * The median of W samples has a standard deviation of about 1.25 sigma / sqrt(W).
+ * A report is sent when the median moves by more than the bias from the last
+ * report, so the filter stays quiet with a bias of TUNE_MARGIN median deviations.
+ * The tuner picks the smallest window (the shortest delay of a knob turn) whose
+ * bias stays within the bounds, and the smallest bias for that window. A new
+ * choice is applied once TUNE_CONFIRM blocks in a row agree on it, and stored in
+ * the EEPROM, so the next boot starts with the tuned filter. The EEPROM is only
+ * written when the choice changes.
+ */
+class NoiseTuner
+{
+    // Bounds of the median window and the bias
+    uint8_t window_min = 1;
+    uint8_t window_max = 1;
+    uint8_t bias_min = 0;
+    uint8_t bias_max = 0;
+    // Selected filter
+    uint8_t window = 1;
+    uint8_t bias = 0;
+    // Current block
+    uint16_t first = 0;
+    uint16_t previous = 0;
+    uint16_t sum = 0;
+    uint8_t count = 0;
+    // Standard deviation of the last block, in 1/16 LSB
+    uint16_t noise = 0;
+    // Completed blocks since init
+    uint16_t blocks = 0;
+    // Choice waiting for confirmation
+    uint8_t candidate_window = 0;
+    uint8_t candidate_bias = 0;
+    uint8_t confirmations = 0;
+
+    /**
+     * @brief Function to choose the filter for a noise level
+     *
+     * @param sigma16 Standard deviation of the samples in 1/16 LSB
+     * @param out_window Chosen median window
+     * @param out_bias Chosen bias
+     */
+    void choose(uint16_t sigma16, uint8_t &out_window, uint8_t &out_bias) const;
+
+    /**
+     * @brief Function to read the stored filter
+     *
+     * @return char 1 if a valid filter within the bounds was read, 0 otherwise
+     */
+    char load();
+
+    /**
+     * @brief Function to store the selected filter
+     */
+    void store() const;
+
+public:
+    /**
+     * @brief Constructor, a constant initialization that needs no startup code
+     */
+    constexpr NoiseTuner() = default;
+
+    /**
+     * @brief Function to set the bounds and select the stored or the default filter
+     *
+     * @details Even windows are rounded down to odd ones, so the median is one sample.
+     *
+     * @param min_window Smallest median window
+     * @param max_window Largest median window, at most the size of the filter queue
+     * @param min_bias Smallest bias
+     * @param max_bias Largest bias
+     * @param default_window Median window without a stored filter
+     * @param default_bias Bias without a stored filter
+     */
+    void init(uint8_t min_window, uint8_t max_window, uint8_t min_bias, uint8_t max_bias, uint8_t default_window, uint8_t default_bias);
+
+    /**
+     * @brief Function to add a sample to the noise measurement
+     *
+     * @param value ADC sample
+     * @return char 1 if the selected filter changed, 0 otherwise
+     */
+    char sample(uint16_t value);
+
+    /**
+     * @brief Function to get the selected median window
+     *
+     * @return uint8_t Median window
+     */
+    uint8_t filterWindow() const
+    {
+        return window;
+    }
+
+    /**
+     * @brief Function to get the selected bias
+     *
+     * @return uint8_t Minimal change of the median to send a new value
+     */
+    uint8_t sendingBias() const
+    {
+        return bias;
+    }
+
+    /**
+     * @brief Function to report the selected filter over serial
+     *
+     * @details This function sends "n<window>,<bias>,<noise>,<blocks>\n", where noise
+     * is the standard deviation of the last block in 1/16 LSB and blocks the number
+     * of measured blocks since boot.
+     *
+     * @param serial Serial used to send the report
+     */
+    void report(Serial &serial) const;
+};
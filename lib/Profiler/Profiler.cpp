@@ -0,0 +1,203 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Profiler.h"
+#include "Features.h"
+
+#ifdef HOST_BUILD
+#define PROGRAM_END ((uint16_t)PROFILER_HOST_FLASH_END)
+#else
+extern uint8_t _etext; // End of .text
+
+#define PROGRAM_END ((uint16_t)&_etext)
+#endif
+
+volatile uint16_t Profiler::bins[PROFILER_BINS];
+volatile uint32_t Profiler::samples = 0;
+volatile uint32_t Profiler::outside = 0;
+uint16_t Profiler::from = 0;
+uint16_t Profiler::to = 0;
+uint8_t Profiler::shift = 0;
+
+// Function to clear the histogram and start sampling
+void Profiler::start(uint16_t first, uint16_t last)
+{
+    stop();
+    from = first >> 1;
+    to = ((last ? last : PROGRAM_END) + 1) >> 1;
+    if (to <= from)
+    {
+        to = from + 1;
+    }
+    shift = 0;
+    while (((uint16_t)(to - from - 1) >> shift) >= PROFILER_BINS)
+    {
+        shift++;
+    }
+    for (uint8_t i = 0; i < PROFILER_BINS; ++i)
+    {
+        bins[i] = 0;
+    }
+    samples = 0;
+    outside = 0;
+
+    // CTC mode, prescaler 64
+    TCCR2A = (1 << WGM21);
+    TCCR2B = (1 << CS22);
+    OCR2A = PROFILER_OCR2A;
+    TCNT2 = 0;
+    TIFR2 = (1 << OCF2A);
+    TIMSK2 |= (1 << OCIE2A);
+}
+
+// Function to stop sampling
+void Profiler::stop()
+{
+    TIMSK2 &= ~(1 << OCIE2A);
+}
+
+// Function to check if the profiler samples
+char Profiler::isRunning()
+{
+    return (TIMSK2 & (1 << OCIE2A)) ? 1 : 0;
+}
+
+// Function to record one sample
+void Profiler::record(uint16_t pc)
+{
+    if (!isRunning())
+    {
+        return;
+    }
+    samples++;
+    if (pc < from || pc >= to)
+    {
+        outside++;
+        return;
+    }
+    uint8_t bin = (uint16_t)(pc - from) >> shift;
+    if (++bins[bin] == 0xFFFF)
+    {
+        // Stop before a bin wraps, so the ratios stay valid
+        stop();
+    }
+}
+
+// Function to report the histogram over serial
+void Profiler::report(Serial &serial)
+{
+    char running = isRunning();
+    stop();
+    serial.sendChar('h');
+    serial.sendNum((uint32_t)from << 1);
+    serial.sendChar(',');
+    serial.sendNum((uint32_t)to << 1);
+    serial.sendChar(',');
+    serial.sendNum(2UL << shift);
+    serial.sendChar(',');
+    serial.sendNum(samples);
+    serial.sendChar(',');
+    serial.sendNum(outside);
+    serial.sendChar(',');
+    serial.sendNum(running);
+    serial.sendChar('\n');
+    for (uint8_t i = 0; i < PROFILER_BINS; ++i)
+    {
+        if (bins[i])
+        {
+            serial.sendString("hb");
+            serial.sendNum(i);
+            serial.sendChar(',');
+            serial.sendNum(bins[i]);
+            serial.sendChar('\n');
+        }
+    }
+    serial.sendString("he\n");
+    if (running)
+    {
+        TIMSK2 |= (1 << OCIE2A);
+    }
+}
+
+// The vector is only defined with the profiler, the class alone is dropped by the linker
+#if !defined(HOST_BUILD) && FEATURE_PROFILING
+// Function to record a sample, called by the Timer2 interrupt with all call-clobbered registers saved
+extern "C" void profiler_record(uint16_t pc) __attribute__((used));
+extern "C" void profiler_record(uint16_t pc)
+{
+    Profiler::record(pc);
+}
+
+// Registers pushed by the interrupt below before it reads the return address
+#define PROFILER_PUSHED 15
+
+/**
+ * @brief Timer2 compare match A interrupt service routine
+ * 
+ * @details The interrupted program counter is the return address on the stack. The
+ * interrupt is naked, as the size of a compiler generated prologue depends on the
+ * compiler, so it saves the registers a function call may clobber itself, reads the
+ * return address from a known offset and calls profiler_record().
+ */
+ISR(TIMER2_COMPA_vect, ISR_NAKED)
+{
+    __asm volatile("    push r0\n"
+                   "    in r0, __SREG__\n"
+                   "    push r0\n"
+                   "    push r1\n"
+                   "    clr r1\n"
+                   "    push r18\n"
+                   "    push r19\n"
+                   "    push r20\n"
+                   "    push r21\n"
+                   "    push r22\n"
+                   "    push r23\n"
+                   "    push r24\n"
+                   "    push r25\n"
+                   "    push r26\n"
+                   "    push r27\n"
+                   "    push r30\n"
+                   "    push r31\n"
+                   // The return address lies above the pushed registers, high byte first
+                   "    in r30, __SP_L__\n"
+                   "    in r31, __SP_H__\n"
+                   "    ldd r25, Z+%0\n"
+                   "    ldd r24, Z+%1\n"
+                   "    call profiler_record\n"
+                   "    pop r31\n"
+                   "    pop r30\n"
+                   "    pop r27\n"
+                   "    pop r26\n"
+                   "    pop r25\n"
+                   "    pop r24\n"
+                   "    pop r23\n"
+                   "    pop r22\n"
+                   "    pop r21\n"
+                   "    pop r20\n"
+                   "    pop r19\n"
+                   "    pop r18\n"
+                   "    pop r1\n"
+                   "    pop r0\n"
+                   "    out __SREG__, r0\n"
+                   "    pop r0\n"
+                   "    reti\n"
+                   :
+                   : "I"(PROFILER_PUSHED + 1), "I"(PROFILER_PUSHED + 2));
+}
+#endif
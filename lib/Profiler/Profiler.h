@@ -0,0 +1,106 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include "Serial.h"
+
+#define PROFILER_BINS 64 // Number of histogram bins
+#define PROFILER_OCR2A 196 // Timer2 compare value, 16 MHz / 64 / 197 = 1269 Hz
+#define PROFILER_HOST_FLASH_END 0x8000 // End of the program of host builds, the flash size
+
+/**
+ * @brief Statistical sampling profiler
+ * 
+ * @details Timer2 interrupts the firmware at a fixed rate and its interrupt records
+ * the interrupted program counter, the return address on the stack, into a histogram
+ * of PROFILER_BINS bins. The bins split a flash range (the whole program by default)
+ * into equal power-of-two sizes, samples outside the range are only counted. The
+ * sampling period of 197 * 64 cycles shares no factor with the Timer0 sampling
+ * periods, so the samples do not lock to the ADC interrupt.
+ * 
+ * A bin that reaches 65535 samples stops the profiler, so the ratios of the bins
+ * stay valid. The bins hold word addresses internally, every interface of the class
+ * uses byte addresses as printed by avr-nm. The host tool in host/profile symbolizes
+ * a report against the ELF file.
+ * 
+ * Host builds have no program counter, there only record() fills the histogram.
+ */
+class Profiler
+{
+    // Samples per bin
+    static volatile uint16_t bins[PROFILER_BINS];
+    // Number of samples
+    static volatile uint32_t samples;
+    // Number of samples outside the range
+    static volatile uint32_t outside;
+    // First word address of the range
+    static uint16_t from;
+    // Word address after the range
+    static uint16_t to;
+    // Bin size is 1 << shift words
+    static uint8_t shift;
+
+public:
+    /**
+     * @brief Function to clear the histogram and start sampling
+     * 
+     * @details This function sets Timer2 to CTC mode with prescaler 64 and enables its
+     * compare match A interrupt. The bin size is the smallest power of two that
+     * covers the range with PROFILER_BINS bins.
+     * 
+     * @param first First byte address of the range
+     * @param last Byte address after the range, 0 for the end of the program
+     */
+    static void start(uint16_t first = 0, uint16_t last = 0);
+
+    /**
+     * @brief Function to stop sampling
+     */
+    static void stop();
+
+    /**
+     * @brief Function to check if the profiler samples
+     * 
+     * @return char 1 if the Timer2 interrupt is enabled, 0 otherwise
+     */
+    static char isRunning();
+
+    /**
+     * @brief Function to record one sample, called from the Timer2 interrupt
+     * 
+     * @param pc Interrupted program counter (word address)
+     */
+    static void record(uint16_t pc);
+
+    /**
+     * @brief Function to report the histogram over serial
+     * 
+     * @details This function sends "h<from>,<to>,<bin size>,<samples>,<outside>,<running>\n"
+     * with byte addresses and sizes, "hb<bin>,<count>\n" for every bin with samples and
+     * "he\n". Sampling pauses while the report is sent, so the report does not profile
+     * itself.
+     * 
+     * @param serial Serial used to send the report
+     */
+    static void report(Serial &serial);
+};
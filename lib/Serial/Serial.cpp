@@ -53,6 +53,14 @@ Serial::Serial(uint32_t baudrate, uint8_t median_filter_size, const uint8_t send
 
     // Initialize serial buffer queue
     queue_init(&ser_buf);
+    if constexpr (Features::flow_control)
+    {
+        // The host may still be stopped by an XOFF sent before a reset
+        flow_pending = 0;
+        rx_stopped = 0;
+        flow_hold = 0;
+        requestFlow(FLOW_XON);
+    }
 
     // Initialize median filter queue if size is greater than 0
     if (median_filter_size > 0)
@@ -64,12 +72,48 @@ Serial::Serial(uint32_t baudrate, uint8_t median_filter_size, const uint8_t send
         }
     }
     filter_size = median_filter_size;
+    window = median_filter_size;
     BIAS = sending_bias;
 }
 
+// Function to change the median window and the sending bias
+void Serial::setFilter(uint8_t samples, uint8_t bias)
+{
+    if (samples > filter_size)
+    {
+        samples = filter_size;
+    }
+    window = samples ? samples : 1;
+    BIAS = bias;
+}
+
 // Function to send a single character over serial
 void Serial::sendChar(char data)
 {
+    if constexpr (Features::flow_control)
+    {
+        for (;;)
+        {
+            uint8_t sreg = SREG;
+            cli();
+            if (UCSR0A & (1 << UDRE0))
+            {
+                if (flow_pending && !flow_hold)
+                {
+                    // The flow byte goes first
+                    UDR0 = flow_pending;
+                    flow_pending = 0;
+                    UCSR0B &= ~(1 << UDRIE0);
+                    SREG = sreg;
+                    continue;
+                }
+                UDR0 = data;
+                SREG = sreg;
+                return;
+            }
+            SREG = sreg;
+        }
+    }
     // Wait for the transmit buffer to be empty
     while (!(UCSR0A & (1 << UDRE0)))
         ;
@@ -77,6 +121,41 @@ void Serial::sendChar(char data)
     UDR0 = data;
 }
 
+// Function to keep flow bytes out of a run of sent bytes
+void Serial::holdFlow(char hold)
+{
+    if constexpr (!Features::flow_control)
+    {
+        return;
+    }
+    uint8_t sreg = SREG;
+    cli();
+    flow_hold = hold;
+    if (hold)
+    {
+        UCSR0B &= ~(1 << UDRIE0);
+    }
+    else if (flow_pending)
+    {
+        UCSR0B |= (1 << UDRIE0);
+    }
+    SREG = sreg;
+}
+
+// Function to start the flow control of a new session
+void Serial::resumeFlow()
+{
+    if constexpr (!Features::flow_control)
+    {
+        return;
+    }
+    uint8_t sreg = SREG;
+    cli();
+    rx_stopped = rxWaiting() > RX_XON_LEVEL;
+    requestFlow(rx_stopped ? FLOW_XOFF : FLOW_XON);
+    SREG = sreg;
+}
+
 // Function to send a string over serial
 void Serial::sendString(const char *data)
 {
@@ -94,57 +173,159 @@ void Serial::sendNum(uint64_t data)
     sendString(buffer);     // Send the string
 }
 
-// Function to send a number with median filtering over serial
-void Serial::sendMedianFilter(uint64_t num)
+// Function to send a report over serial
+void Serial::sendReport(uint64_t value)
 {
-    // If still in cold start phase, fill the median filter queue
-    if (_coldstart_median_count < filter_size)
+    if constexpr (Features::stamps)
     {
-        medianFilterQueue[_coldstart_median_count] = num;
-        _coldstart_median_count++;
-        sendNum(medianFilterQueue[_coldstart_median_count - 1]);
-        sendChar('\n');
-        last_sended = num;
+        uint32_t time = Clock::micros();
+        sendNum(value);
+        if (stamped)
+        {
+            sendChar(',');
+            sendNum(report_seq);
+            sendChar(',');
+            char buffer[11]; // Max length of uint32_t is 10 digits
+            ultoa(time, buffer, 10);
+            sendString(buffer);
+        }
+        report_seq++;
     }
     else
     {
-        // Shift the values in the median filter queue
-        for (uint8_t i = 0; i < filter_size - 1; ++i)
-        {
-            medianFilterQueue[i] = medianFilterQueue[i + 1];
-        }
-        medianFilterQueue[filter_size - 1] = num;
+        sendNum(value);
+    }
+    sendChar('\n');
+}
+
+// Function to calculate the median of the newest samples in the median filter queue
+uint64_t Serial::medianOf(uint8_t count, uint8_t index)
+{
+    if (count > filter_size)
+    {
+        count = filter_size;
+        index = count / 2;
+    }
 
-        // Create a copy of the median filter queue for sorting
-        uint64_t medianFilter[filter_size];
-        for (uint8_t i = 0; i < filter_size; ++i)
+    // Create a copy of the newest samples for sorting
+    uint64_t medianFilter[count];
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        medianFilter[i] = medianFilterQueue[filter_size - count + i];
+    }
+
+    // Optimized bubble sort to find the median
+    for (uint8_t i = 0; i < count - 1; ++i)
+    {
+        for (uint8_t j = i + 1; j < count; ++j)
         {
-            medianFilter[i] = medianFilterQueue[i];
+            if (medianFilter[i] > medianFilter[j])
+            {
+                // Swap the values
+                uint64_t temp = medianFilter[i];
+                medianFilter[i] = medianFilter[j];
+                medianFilter[j] = temp;
+            }
         }
+    }
+    return medianFilter[index];
+}
 
-        // Optimized bubble sort to find the median
-        for (uint8_t i = 0; i < filter_size - 1; ++i)
+// Function to update the step tracking state with a new sample
+void Serial::updateStepTracking(uint64_t num)
+{
+    if constexpr (!Features::step_tracking)
+    {
+        return;
+    }
+    if (!step_tracking)
+    {
+        return;
+    }
+    char rising = num > last_sended;
+    uint64_t difference = rising ? num - last_sended : last_sended - num;
+    if (!tracking)
+    {
+        // A step is a run of samples beyond the threshold on the same side
+        if (difference > STEP_THRESHOLD && (step_count == 0 || rising == step_rising))
         {
-            for (uint8_t j = i + 1; j < filter_size; ++j)
+            step_rising = rising;
+            if (++step_count >= STEP_CONFIRM)
             {
-                if (medianFilter[i] > medianFilter[j])
-                {
-                    // Swap the values
-                    uint64_t temp = medianFilter[i];
-                    medianFilter[i] = medianFilter[j];
-                    medianFilter[j] = temp;
-                }
+                tracking = 1;
+                step_count = 0;
             }
         }
+        else
+        {
+            step_count = (difference > STEP_THRESHOLD) ? 1 : 0;
+            step_rising = rising;
+        }
+    }
+    else if (difference > STEP_THRESHOLD)
+    {
+        step_count = 0;
+    }
+    else if (++step_count > window / 2)
+    {
+        // The settled samples are the majority of the full window again, so the
+        // middle sample taken by the median (index window / 2) is a settled one
+        // whichever side of them the step samples lie
+        tracking = 0;
+        step_count = 0;
+    }
+}
+
+// Function to send a number with median filtering over serial
+char Serial::sendMedianFilter(uint64_t num)
+{
+    // Shift the values in the median filter queue, the newest sample is the last
+    for (uint8_t i = 0; i < filter_size - 1; ++i)
+    {
+        medianFilterQueue[i] = medianFilterQueue[i + 1];
+    }
+    medianFilterQueue[filter_size - 1] = num;
+
+    // If still in cold start phase, every sample is sent until the window is full
+    if (_coldstart_median_count < window)
+    {
+        _coldstart_median_count++;
+        // With a volume curve only the first sample and changed steps are sent
+        uint8_t step = (uint8_t)mapValue(num);
+        if (hasCurve() && _coldstart_median_count > 1 && step == last_step)
+        {
+            return 0;
+        }
+        sendReport(mapValue(num));
+        last_sended = num;
+        last_step = step;
+        return 1;
+    }
+    else
+    {
+        // Count on until the whole queue holds samples, the shift keeps it full,
+        // so a wider window set later does not start a new cold start phase
+        if (_coldstart_median_count < filter_size)
+        {
+            _coldstart_median_count++;
+        }
+        // The step tracking mode takes the median of the newest samples only
+        updateStepTracking(num);
+        uint64_t median = (Features::step_tracking && tracking) ? medianOf(STEP_WINDOW, STEP_WINDOW / 2) : medianOf(window, window / 2);
 
-        // Send the median value if it differs from the last sent value by more than the bias
-        if (abs(medianFilter[uint8_t(filter_size / 2) + 1] - last_sended) > BIAS)
+        // Send the median value if it differs from the last sent value by more than the bias,
+        // with a volume curve only if the volume step changes as well
+        uint64_t difference = (median > last_sended) ? median - last_sended : last_sended - median;
+        uint8_t step = (uint8_t)mapValue(median);
+        if (difference > BIAS && (!hasCurve() || step != last_step))
         {
-            sendNum(medianFilter[uint8_t(filter_size / 2) + 1]);
-            last_sended = medianFilter[uint8_t(filter_size / 2) + 1];
-            sendChar('\n');
+            sendReport(mapValue(median));
+            last_sended = median;
+            last_step = step;
+            return 1;
         }
     }
+    return 0;
 }
 
 // Function to read a single character from the serial buffer
@@ -153,6 +334,17 @@ char Serial::readChar()
     uint8_t value;
     queue_front(&ser_buf, &value);
     queue_pop(&ser_buf);
+    if (Features::flow_control && rx_stopped)
+    {
+        uint8_t sreg = SREG;
+        cli();
+        if (rx_stopped && rxWaiting() <= RX_XON_LEVEL)
+        {
+            rx_stopped = 0;
+            requestFlow(FLOW_XON);
+        }
+        SREG = sreg;
+    }
     return value;
 }
 
@@ -168,6 +360,11 @@ volatile char Serial::rec = 0;
 // Static variable for the serial buffer queue
 struct TQueue Serial::ser_buf;
 
+// Static variables of the flow control
+volatile uint8_t Serial::flow_pending = 0;
+volatile char Serial::rx_stopped = 0;
+volatile char Serial::flow_hold = 0;
+
 // Interrupt service routine for USART RX complete
 ISR(USART_RX_vect)
 {
@@ -182,5 +379,25 @@ ISR(USART_RX_vect)
     {
         // Set the received flag
         Serial::rec = 1;
+        if (Features::flow_control && !Serial::rx_stopped && Serial::rxWaiting() >= RX_XOFF_LEVEL)
+        {
+            // Stop the host while the queue still has room for the bytes in flight
+            Serial::rx_stopped = 1;
+            Serial::requestFlow(FLOW_XOFF);
+        }
     }
-}
\ No newline at end of file
+}
+
+#if FEATURE_FLOW_CONTROL
+// Interrupt service routine for USART data register empty
+ISR(USART_UDRE_vect)
+{
+    // Only a pending flow byte enables the interrupt
+    if (Serial::flow_pending)
+    {
+        UDR0 = Serial::flow_pending;
+        Serial::flow_pending = 0;
+    }
+    UCSR0B &= ~(1 << UDRIE0);
+}
+#endif
\ No newline at end of file
@@ -22,8 +22,27 @@
 #include <avr/interrupt.h>
 #include <stdlib.h>
 #include "TQueue.h"
+#include "Clock.h"
+#include "VolumeCurve.h"
+#include "Features.h"
 
 #define FOSC 16000000UL // Clock Speed
+#define STEP_THRESHOLD 16 // Distance from the last sent value that counts as a step
+#define STEP_CONFIRM 3 // Consecutive samples beyond the threshold that start step tracking
+#define STEP_WINDOW 3 // Median window while a step is tracked
+#define FLOW_XON 0x11 // Flow byte that restarts the host
+#define FLOW_XOFF 0x13 // Flow byte that stops the host
+#define RX_XOFF_LEVEL 24 // Received bytes waiting in the queue that send XOFF
+#define RX_XON_LEVEL 8 // Received bytes waiting in the queue that send XON again
+#define RX_FLOW_HOLD_MAX 67 // Longest run of sent bytes a flow byte must not split (a capture frame)
+#define RX_FLOW_SLACK 32 // Bytes the host may still send after it received XOFF
+
+// Both directions run at the same baud rate, so every delay of the XOFF is a number of
+// received bytes: the held run, the byte in UDR0 and the byte being shifted out, the XOFF
+// itself and the slack of the host. The queue keeps one element free.
+#if RX_XOFF_LEVEL + RX_FLOW_HOLD_MAX + 3 + RX_FLOW_SLACK > QUEUE_MAXCOUNT - 1
+#error "The receive queue cannot absorb the bytes sent until the host stops"
+#endif
 
 /**
  * @brief Serial communication class
@@ -34,16 +53,38 @@ class Serial
     inline uint16_t calculateBaud(uint32_t baudrate);
     // Function to count the number of digits in a number
     uint16_t countDigits(uint64_t num);
+    // Function to calculate the median of the newest samples in the median filter queue
+    uint64_t medianOf(uint8_t count, uint8_t index);
+    // Function to update the step tracking state with a new sample
+    void updateStepTracking(uint64_t num);
     // Pointer to the median filter queue
     uint64_t* medianFilterQueue = nullptr;
-    // Counter for the cold start phase of the median filter
+    // Samples in the median filter queue, counts up to filter_size
     uint8_t _coldstart_median_count = 0;
-    // Size of the median filter
+    // Size of the median filter queue
     uint8_t filter_size = 0;
+    // Number of the newest samples taken by the median, at most filter_size
+    uint8_t window = 0;
     // Last sent value
     uint64_t last_sended = 0;
     // Bias value for sending data
     uint64_t BIAS = 0;
+    // Volume curve table in flash, nullptr for raw reports
+    const uint8_t *curve = nullptr;
+    // Last sent volume step when a curve is selected
+    uint8_t last_step = 0;
+    // Reports carry a sequence number and a timestamp flag
+    char stamped = 0;
+    // Sequence number of the next report
+    uint16_t report_seq = 0;
+    // Step tracking mode enabled flag
+    char step_tracking = 0;
+    // A step is being tracked with the short window
+    char tracking = 0;
+    // Direction of the samples beyond the threshold, 1 above the last sent value
+    char step_rising = 0;
+    // Consecutive samples beyond the threshold, or settled samples while tracking
+    uint8_t step_count = 0;
 
 public:
     // Static variable to indicate if a character has been received
@@ -52,6 +93,15 @@ public:
     // Static variable for the serial buffer queue
     static struct TQueue ser_buf;
 
+    // Flow byte waiting for the transmitter, 0 for none
+    static volatile uint8_t flow_pending;
+
+    // XOFF was requested and XON not yet
+    static volatile char rx_stopped;
+
+    // Flow bytes wait until the end of a held run of sent bytes
+    static volatile char flow_hold;
+
     /**
      * @brief Constructor to initialize Serial communication
      * 
@@ -72,7 +122,9 @@ public:
      * 
      * @details This function waits for the transmit buffer to be empty before
      * sending the character. It ensures that the character is sent correctly
-     * by checking the UDRE0 flag.
+     * by checking the UDRE0 flag. A pending flow byte is sent first; the check
+     * and the write run with interrupts disabled, because the UDRE interrupt
+     * writes the flow bytes too.
      * 
      * @param data Character to send
      */
@@ -100,23 +152,190 @@ public:
      */
     void sendNum(uint64_t data);
 
+    /**
+     * @brief Function to send a report over serial
+     * 
+     * @details This function sends the value followed by '\n'. In the stamped
+     * format the value is followed by the sequence number of the report and the
+     * device time in microseconds: "<value>,<sequence>,<time>\n". Every report
+     * increments the sequence number, so the host can detect dropped reports.
+     * 
+     * @param value Value to report
+     */
+    void sendReport(uint64_t value);
+
+    /**
+     * @brief Function to select the report format
+     * 
+     * @param enable 1 for the stamped format, 0 for bare values
+     */
+    void setStamped(char enable)
+    {
+        stamped = Features::stamps ? enable : 0;
+    }
+
+    /**
+     * @brief Function to check if the stamped report format is selected
+     * 
+     * @return char 1 for the stamped format, 0 for bare values
+     */
+    char isStamped() const
+    {
+        return stamped;
+    }
+
     /**
      * @brief Function to send a number with median filtering over serial
      * 
      * @details This function applies a median filter to the number before
      * sending it. It maintains a queue of recent numbers and calculates the
      * median value. If the median value differs from the last sent value by
-     * more than the specified bias, it sends the median value.
+     * more than the specified bias, it sends the median value as a report.
+     * With a volume curve selected the median is mapped to a volume step and
+     * only a changed step is sent, the bias then keeps a median jittering at the
+     * border of two steps from sending both alternately.
      * 
      * @param data Number to send
+     * @return char 1 if the median value was sent, 0 otherwise
+     */
+    char sendMedianFilter(uint64_t data);
+
+    /**
+     * @brief Function to change the median window and the sending bias
+     * 
+     * @details The queue holds the newest samples of the full filter size once
+     * that many arrived, from then on the window can change at any time without
+     * a new cold start.
+     * 
+     * @param samples Number of the newest samples taken by the median, clamped to 1..filter size
+     * @param bias Minimal change of the median to send a new value
+     */
+    void setFilter(uint8_t samples, uint8_t bias);
+
+    /**
+     * @brief Function to get the median window
+     * 
+     * @return uint8_t Number of the newest samples taken by the median
      */
-    void sendMedianFilter(uint64_t data);
+    uint8_t filterWindow() const
+    {
+        return window;
+    }
+
+    /**
+     * @brief Function to get the sending bias
+     * 
+     * @return uint8_t Minimal change of the median to send a new value
+     */
+    uint8_t sendingBias() const
+    {
+        return (uint8_t)BIAS;
+    }
+
+    /**
+     * @brief Function to enable the low-latency step tracking mode
+     * 
+     * @details In this mode sendMedianFilter watches for a sustained step: STEP_CONFIRM
+     * consecutive samples on the same side of the last sent value and further than
+     * STEP_THRESHOLD from it. During the step the median is taken over the newest
+     * STEP_WINDOW samples only, so the reports follow the knob closely. Once the samples
+     * stay within STEP_THRESHOLD of the last sent value for more than half of the full
+     * window the filter returns to the full window, whose median is then a settled sample.
+     * 
+     * @param enable 1 to enable step tracking, 0 for the plain median filter
+     */
+    void setStepTracking(char enable)
+    {
+        step_tracking = Features::step_tracking ? enable : 0;
+        tracking = 0;
+        step_count = 0;
+    }
+
+    /**
+     * @brief Function to check if the step tracking mode is enabled
+     * 
+     * @return char 1 if step tracking is enabled, 0 otherwise
+     */
+    char isStepTracking() const
+    {
+        return step_tracking;
+    }
+
+    /**
+     * @brief Function to check if a step is being tracked with the short window
+     * 
+     * @return char 1 while a step is tracked, 0 otherwise
+     */
+    char isTracking() const
+    {
+        return tracking;
+    }
+
+    /**
+     * @brief Function to select the volume curve of the reports
+     * 
+     * @param table Table in flash from VolumeCurve::table(), nullptr for raw values
+     */
+    void setCurve(const uint8_t *table)
+    {
+        curve = Features::curves ? table : nullptr;
+    }
+
+    /**
+     * @brief Function to check if reports are mapped to volume steps
+     * 
+     * @return char 1 if a volume curve is selected, 0 for raw values
+     */
+    char hasCurve() const
+    {
+        return Features::curves && curve != nullptr;
+    }
+
+    /**
+     * @brief Function to map a value to the reported value
+     * 
+     * @param value Filtered value from 0 to 1023
+     * @return uint64_t Volume step with a curve selected, the value otherwise
+     */
+    uint64_t mapValue(uint64_t value) const
+    {
+        if constexpr (Features::curves)
+        {
+            return curve ? VolumeCurve::map(curve, (uint16_t)value) : value;
+        }
+        return value;
+    }
+
+    /**
+     * @brief Function to calculate the median of the newest samples
+     * 
+     * @details This is the sort used by sendMedianFilter, without updating the
+     * window or sending anything.
+     * 
+     * @param count Number of the newest samples, at most the filter size
+     * @return uint64_t Median of the samples
+     */
+    uint64_t median(uint8_t count)
+    {
+        return medianOf(count, count / 2);
+    }
+
+    /**
+     * @brief Function to get the last value sent by sendMedianFilter
+     * 
+     * @return uint64_t Last sent value
+     */
+    uint64_t lastSent() const
+    {
+        return last_sended;
+    }
 
     /**
      * @brief Function to read a single character from the serial buffer
      * 
      * @details This function reads a character from the serial buffer queue.
-     * It removes the character from the queue after reading it.
+     * It removes the character from the queue after reading it. When the host
+     * was stopped and the waiting bytes fell to RX_XON_LEVEL, it requests XON.
      * 
      * @return char Character read from the buffer
      */
@@ -131,7 +350,61 @@ public:
      * @return char 1 if characters are available, 0 otherwise
      */
     char available();
+
+    /**
+     * @brief Function to get the number of received bytes waiting in the queue
+     * 
+     * @return uint8_t Number of waiting bytes
+     */
+    static uint8_t rxWaiting()
+    {
+        return (uint8_t)((ser_buf.iPushPos - ser_buf.iPopPos) % QUEUE_MAXCOUNT);
+    }
+
+    /**
+     * @brief Function to queue a flow byte, called with interrupts disabled
+     * 
+     * @details A new request replaces a flow byte that is still pending, the
+     * newest state wins. Cancelling both instead would lose the XOFF that follows
+     * the XON sent after a reset, when the host was never stopped. The UDRE
+     * interrupt sends the byte unless the flow is held.
+     * 
+     * @param data FLOW_XON or FLOW_XOFF
+     */
+    static void requestFlow(uint8_t data)
+    {
+        flow_pending = data;
+        if (!flow_hold)
+        {
+            UCSR0B |= (1 << UDRIE0);
+        }
+    }
+
+    /**
+     * @brief Function to keep flow bytes out of a run of sent bytes
+     * 
+     * @details The binary capture frames may contain the values of XON and XOFF,
+     * so a flow byte requested during a frame waits until its end. A held run is
+     * at most RX_FLOW_HOLD_MAX bytes long, the headroom of the receive queue above
+     * RX_XOFF_LEVEL covers it.
+     * 
+     * @param hold 1 at the start of the run, 0 at its end
+     */
+    void holdFlow(char hold);
+
+    /**
+     * @brief Function to start the flow control of a new session
+     * 
+     * @details The new host may have missed the flow byte sent to the previous
+     * one and would wait for an XON forever, so the state of the queue is sent
+     * again: XON if it holds at most RX_XON_LEVEL bytes, otherwise XOFF, and the
+     * XON then follows once the main loop has read the queue down.
+     */
+    void resumeFlow();
 };
 
 // Interrupt service routine for USART RX complete
-ISR(USART_RX_vect);
\ No newline at end of file
+ISR(USART_RX_vect);
+
+// Interrupt service routine for USART data register empty, sends the flow bytes
+ISR(USART_UDRE_vect);
\ No newline at end of file
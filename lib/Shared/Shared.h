@@ -0,0 +1,225 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// Compiler barrier, keeps the sequence counter accesses around the value copy
+#define SHARED_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/**
+ * @brief Function to copy a shared value byte by byte
+ *
+ * @details On the MCU a multi-byte value is loaded one byte at a time anyway, so
+ * an interrupt can hit between any two bytes. Host builds copy byte-wise as well
+ * and call host_preempt() before every byte, so a simulator can run an interrupt
+ * at each of these boundaries.
+ *
+ * @param destination Destination of the copy
+ * @param source Source of the copy
+ * @param size Number of bytes
+ */
+inline void shared_copy(volatile uint8_t *destination, const volatile uint8_t *source, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; ++i)
+    {
+#ifdef HOST_BUILD
+        host_preempt();
+#endif
+        destination[i] = source[i];
+    }
+}
+
+/**
+ * @brief Consistent snapshot of a value written by an interrupt
+ *
+ * @details The value is guarded by a sequence counter. The writer (an ISR)
+ * increments the counter to an odd value, stores the value and increments the
+ * counter to an even value again. The reader (the main loop) copies the value
+ * between two reads of the counter and retries when the counter changed or was
+ * odd, so it never sees a half written value and never disables interrupts.
+ * The writer never waits.
+ *
+ * @tparam T Type of the value, any trivially copyable type
+ */
+template <class T>
+class Snapshot
+{
+protected:
+    // Sequence counter, odd while the value is written
+    volatile uint8_t seq = 0;
+    // Stored value
+    volatile uint8_t value[sizeof(T)] = {};
+
+    // Function to copy a consistent value and return its sequence number
+    uint8_t load(T &out) const
+    {
+        uint8_t before;
+        uint8_t after;
+        do
+        {
+            before = seq;
+            SHARED_BARRIER();
+            shared_copy((volatile uint8_t *)&out, value, sizeof(T));
+            SHARED_BARRIER();
+            after = seq;
+        } while ((before & 1) || before != after);
+        return before;
+    }
+
+public:
+    /**
+     * @brief Function to store a new value, called by the ISR
+     *
+     * @param data New value
+     */
+    void write(T data)
+    {
+        seq = seq + 1;
+        SHARED_BARRIER();
+        shared_copy(value, (const volatile uint8_t *)&data, sizeof(T));
+        SHARED_BARRIER();
+        seq = seq + 1;
+    }
+
+    /**
+     * @brief Function to read a consistent copy of the value, called by the main loop
+     *
+     * @return T Copy of the value
+     */
+    T read() const
+    {
+        T out;
+        load(out);
+        return out;
+    }
+
+    /**
+     * @brief Function to set the value and the sequence counter to their initial state
+     *
+     * @details Only to be called while the writer ISR cannot run.
+     *
+     * @param data Initial value
+     */
+    void reset(const T &data)
+    {
+        seq = 0;
+        shared_copy(value, (const volatile uint8_t *)&data, sizeof(T));
+    }
+};
+
+/**
+ * @brief Latest-value mailbox from an interrupt to the main loop
+ *
+ * @details The ISR posts values without waiting, a new value replaces the
+ * previous one. The main loop takes the newest consistent value once and
+ * can tell how many posted values it never saw. The sequence counter has 8 bits,
+ * so a take that follows exactly 128 posts sees no new value; the main loop has
+ * to take far more often than that.
+ *
+ * @tparam T Type of the value, any trivially copyable type
+ */
+template <class T>
+class Mailbox : public Snapshot<T>
+{
+    // Sequence number of the last taken value
+    uint8_t seen = 0;
+    // Number of posted values that were replaced before they were taken
+    uint8_t overwritten = 0;
+
+public:
+    /**
+     * @brief Function to post a new value, called by the ISR
+     *
+     * @param data New value
+     */
+    void post(T data)
+    {
+        this->write(data);
+    }
+
+    /**
+     * @brief Function to take the newest value, called by the main loop
+     *
+     * @param out Newest value, only written when there is a new value
+     * @return char 1 if a value was posted since the last take, 0 otherwise
+     */
+    char take(T &out)
+    {
+        T data;
+        uint8_t current = this->load(data);
+        if (current == seen)
+        {
+            return 0;
+        }
+        overwritten += (uint8_t)((uint8_t)(current - seen) / 2 - 1);
+        seen = current;
+        out = data;
+        return 1;
+    }
+
+    /**
+     * @brief Function to read the newest value without taking it
+     *
+     * @return T Copy of the newest value
+     */
+    T peek() const
+    {
+        return this->read();
+    }
+
+    /**
+     * @brief Function to get the number of values replaced before they were taken
+     *
+     * @return uint8_t Number of lost values, wraps around
+     */
+    uint8_t lost() const
+    {
+        return overwritten;
+    }
+
+    /**
+     * @brief Function to drop the pending value without counting replaced values as lost
+     *
+     * @details For values posted on purpose without a reader, e.g. by a benchmark of
+     * the writer ISR, or left over from a previous session. Only to be called while
+     * the writer ISR cannot run.
+     */
+    void discard()
+    {
+        T data;
+        seen = this->load(data);
+    }
+
+    /**
+     * @brief Function to set the mailbox to its initial state without a pending value
+     *
+     * @details Only to be called while the writer ISR cannot run.
+     *
+     * @param data Initial value
+     */
+    void reset(const T &data)
+    {
+        Snapshot<T>::reset(data);
+        seen = 0;
+        overwritten = 0;
+    }
+};
@@ -0,0 +1,132 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "SignalGen.h"
+
+// Knob gesture (slow turn up, hold, fast turn down, hold) with +-2 LSB of sensor noise
+static const uint16_t gesture[SIGNAL_TABLE_SIZE] PROGMEM = {
+    122, 150, 180, 212, 238, 271, 299, 328, 359, 388, 420, 451, 479, 511, 542, 568,
+    602, 629, 658, 689, 721, 750, 779, 811, 839, 838, 839, 842, 842, 841, 839, 839,
+    838, 838, 839, 839, 839, 749, 660, 570, 479, 392, 299, 209, 199, 201, 200, 198,
+    200, 201, 199, 199, 200, 198, 200, 200, 202, 202, 198, 202, 200, 198, 200, 200,
+};
+
+// Default periods of the sources, in samples
+static const uint16_t default_period[SIGNAL_SHAPES] PROGMEM = {
+    0,   // ADC
+    200, // Ramp, one sweep per second at the fast sampling period
+    50,  // Step
+    100, // Square
+    1,   // Noise
+    4,   // Table
+};
+
+// Function to select and restart the input source
+void SignalGen::select(SignalShape source, uint16_t from, uint16_t to, uint16_t samples, uint16_t noise_seed)
+{
+    if (source >= SIGNAL_SHAPES)
+    {
+        source = SIGNAL_ADC;
+    }
+    if (to > SIGNAL_MAX)
+    {
+        to = SIGNAL_MAX;
+    }
+    if (from > to)
+    {
+        from = to;
+    }
+
+    // Only the ADC interrupt uses the generator, keep it out while the state changes
+    uint8_t adc_interrupt = ADCSRA & (1 << ADIE);
+    ADCSRA &= ~(1 << ADIE);
+    shape = source;
+    low = from;
+    high = to;
+    period = samples ? samples : pgm_read_word(&default_period[source]);
+    seed = noise_seed ? noise_seed : 1;
+    noise = seed;
+    position = 0;
+    index = 0;
+    ADCSRA |= adc_interrupt;
+}
+
+// Function to report the selected source over serial
+void SignalGen::report(Serial &serial) const
+{
+    char buffer[6]; // Max length of uint16_t is 5 digits
+    const uint16_t values[] = {low, high, period, seed};
+    serial.sendChar('g');
+    serial.sendChar('0' + shape);
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        serial.sendChar(',');
+        utoa(values[i], buffer, 10);
+        serial.sendString(buffer);
+    }
+    serial.sendChar('\n');
+}
+
+// Function to generate the sample at the current position
+uint16_t SignalGen::generate()
+{
+    uint16_t span = high - low;
+    uint16_t value = low;
+    switch (shape)
+    {
+    case SIGNAL_RAMP:
+        value = low + (uint16_t)((uint32_t)span * position / period);
+        break;
+    case SIGNAL_STEP:
+        value = low + (uint16_t)((uint32_t)span * index / (SIGNAL_STAIRS - 1));
+        break;
+    case SIGNAL_SQUARE:
+        value = (position < period / 2) ? low : high;
+        break;
+    case SIGNAL_NOISE:
+        // xorshift16
+        noise ^= noise << 7;
+        noise ^= noise >> 9;
+        noise ^= noise << 8;
+        value = low + noise % (span + 1);
+        break;
+    case SIGNAL_TABLE:
+        value = pgm_read_word(&gesture[index]);
+        break;
+    default:
+        break;
+    }
+
+    // Advance the position, the step and the table also advance their index
+    if (++position >= period)
+    {
+        position = 0;
+        if (shape == SIGNAL_STEP)
+        {
+            index = (index + 1) % SIGNAL_STAIRS;
+        }
+        else if (shape == SIGNAL_TABLE)
+        {
+            index = (index + 1) % SIGNAL_TABLE_SIZE;
+        }
+    }
+    return value;
+}
@@ -0,0 +1,139 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "Serial.h"
+
+#define SIGNAL_MAX 1023 // Highest generated value, the ADC range
+#define SIGNAL_STAIRS 8 // Number of stairs of the step signal
+#define SIGNAL_TABLE_SIZE 64 // Number of entries of the recorded table
+
+/**
+ * @brief Input sources of the ADC interrupt
+ */
+enum SignalShape : uint8_t
+{
+    SIGNAL_ADC, ///< Real ADC conversion result
+    SIGNAL_RAMP, ///< Sawtooth from low to high, period samples per sweep
+    SIGNAL_STEP, ///< SIGNAL_STAIRS stairs from low to high, period samples per stair
+    SIGNAL_SQUARE, ///< Low for the first half of the period, high for the second
+    SIGNAL_NOISE, ///< Uniform noise between low and high from a seeded generator
+    SIGNAL_TABLE, ///< Recorded knob gesture from flash, period samples per entry
+    SIGNAL_SHAPES ///< Number of input sources
+};
+
+/**
+ * @brief Signal generator class
+ *
+ * @details The generator replaces the ADC conversion result in the ADC interrupt,
+ * so the whole firmware (median filter, reports, display, sampling period) runs on
+ * a repeatable input. The generator advances by one step per ADC interrupt, so the
+ * signal follows the sampling period of the firmware. Selecting a source restarts
+ * it, so two runs with the same selection produce the same samples.
+ */
+class SignalGen
+{
+    // Selected source
+    SignalShape shape = SIGNAL_ADC;
+    // Lowest generated value
+    uint16_t low = 0;
+    // Highest generated value
+    uint16_t high = SIGNAL_MAX;
+    // Samples per sweep, stair, cycle or table entry
+    uint16_t period = 0;
+    // Seed of the noise generator
+    uint16_t seed = 1;
+    // Position in the period
+    uint16_t position = 0;
+    // Stair or table entry index
+    uint8_t index = 0;
+    // Noise generator state
+    uint16_t noise = 1;
+    // Last value returned by next
+    uint16_t last = 0;
+
+    /**
+     * @brief Function to generate the sample at the current position
+     *
+     * @return uint16_t Generated sample
+     */
+    uint16_t generate();
+
+public:
+    /**
+     * @brief Constructor, a constant initialization that needs no startup code
+     */
+    constexpr SignalGen() = default;
+
+    /**
+     * @brief Function to select and restart the input source
+     *
+     * @details A period or seed of 0 selects the default of the source.
+     *
+     * @param source Input source
+     * @param from Lowest generated value
+     * @param to Highest generated value
+     * @param samples Samples per sweep, stair, cycle or table entry
+     * @param noise_seed Seed of the noise generator
+     */
+    void select(SignalShape source, uint16_t from = 0, uint16_t to = SIGNAL_MAX, uint16_t samples = 0, uint16_t noise_seed = 0);
+
+    /**
+     * @brief Function to report the selected source over serial
+     *
+     * @details This function sends "g<source>,<low>,<high>,<period>,<seed>\n".
+     *
+     * @param serial Serial used to send the report
+     */
+    void report(Serial &serial) const;
+
+    /**
+     * @brief Function to get the next input sample, called from the ADC interrupt
+     *
+     * @param adc Conversion result of the ADC
+     * @return uint16_t The conversion result or the generated sample
+     */
+    inline uint16_t next(uint16_t adc)
+    {
+        last = (shape == SIGNAL_ADC) ? adc : generate();
+        return last;
+    }
+
+    /**
+     * @brief Function to get the last input sample
+     *
+     * @return uint16_t Last sample returned by next
+     */
+    uint16_t lastSample() const
+    {
+        return last;
+    }
+
+    /**
+     * @brief Function to get the selected source
+     *
+     * @return SignalShape Selected source
+     */
+    SignalShape source() const
+    {
+        return shape;
+    }
+};
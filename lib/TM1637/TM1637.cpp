@@ -19,153 +19,465 @@
 //  - Original source: https://github.com/avishorp/TM1637
 
 
+#include <string.h>
 #include "TM1637.h"
 
-// Function to start communication with TM1637
-void TM1637::start()
+// Function to queue segments for the TM1637 display
+void TM1637Base::setSegments(const uint8_t *segments, uint8_t length, uint8_t pos)
 {
-    // Set DIO pin as output
-    DDRD |= (1 << DIO);
-    _delay_us(bit_delay);
+    if (length > DISPLAY_DIGITS)
+    {
+        length = DISPLAY_DIGITS;
+    }
+    // COMM1, COMM2 + first digit address, the data bytes, COMM3 + brightness
+    pending[0] = TM1637_I2C_COMM1;
+    pending[1] = TM1637_I2C_COMM2 + (pos & 0x03);
+    for (uint8_t k = 0; k < length; k++)
+        pending[2 + k] = segments[k];
+    pending[2 + length] = TM1637_I2C_COMM3 + (brightness & 0x0f);
+    pending_length = length + 3;
 }
 
-// Function to stop communication with TM1637
-void TM1637::stop()
+// Function to start sending the queued frame
+char TM1637Base::loadPending()
 {
-    // Set DIO pin as output
-    DDRD |= (1 << DIO);
-    _delay_us(bit_delay);
-    // Set CLK pin as input
-    DDRD &= ~(1 << CLK);
-    _delay_us(bit_delay);
-    // Set DIO pin as input
-    DDRD &= ~(1 << DIO);
-    _delay_us(bit_delay);
+    if (pending_length == 0)
+    {
+        return 0;
+    }
+    for (uint8_t k = 0; k < pending_length; k++)
+        tx[k] = pending[k];
+    tx_length = pending_length;
+    pending_length = 0;
+    bus_byte = 0;
+    bus_state = BUS_START;
+    return 1;
 }
 
-// Function to write a byte to TM1637
-void TM1637::writeByte(uint8_t b)
+// Function to start sending the current byte
+void TM1637Base::beginByte()
 {
-    uint8_t data = b;
+    bus_state = BUS_BYTE;
+    bus_data = tx[bus_byte];
+    bus_bit = 0;
+    bus_sub = 0;
+}
 
-    // 8 Data Bits
-    for (uint8_t i = 0; i < 8; i++)
+// Function to advance to the next byte after an acknowledge
+void TM1637Base::nextByte()
+{
+    bus_byte++;
+    if (bus_byte == 1 || bus_byte >= tx_length - 1)
     {
-        // CLK low
-        DDRD |= (1 << CLK);
-        _delay_us(bit_delay);
-
-        // Set data bit
-        if (data & 0x01)
-            DDRD &= ~(1 << DIO);
-        else
-            DDRD |= (1 << DIO);
-
-        _delay_us(bit_delay);
-
-        // CLK high
-        DDRD &= ~(1 << CLK);
-        _delay_us(bit_delay);
-        data = data >> 1;
+        bus_state = BUS_STOP;
+        bus_sub = 0;
     }
+    else
+    {
+        beginByte();
+    }
+}
 
-    // Wait for acknowledge
-    // CLK to zero
-    DDRD |= (1 << CLK);
-    DDRD &= ~(1 << DIO);
-    _delay_us(bit_delay);
+// Function to continue after a stop condition
+void TM1637Base::finishStop()
+{
+    bus_state = (bus_byte >= tx_length) ? BUS_IDLE : BUS_START;
+}
 
-    // CLK to high
-    DDRD &= ~(1 << CLK);
-    _delay_us(bit_delay);
-    uint8_t ack = PIND & (1 << DIO);
-    if (ack == 0)
-        DDRD |= (1 << DIO);
+// Function to send the queued frame completely
+void TM1637Base::flush()
+{
+    while (step())
+    {
+        _delay_us(TM1637_BIT_DELAY);
+    }
+}
 
-    _delay_us(bit_delay);
-    // CLK high
-    DDRD |= (1 << CLK);
-    _delay_us(bit_delay);
+// Function to register a display
+char TM1637Scheduler::add(TM1637Base &display)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (displays[i] == &display)
+        {
+            return 1;
+        }
+    }
+    if (count == TM1637_MAX_DISPLAYS)
+    {
+        return 0;
+    }
+    displays[count++] = &display;
+    return 1;
 }
 
-// Function to set segments on the TM1637 display
-void TM1637::setSegments(const uint8_t *segments, uint8_t length, uint8_t pos)
+// Function to advance all displays by one step
+char TM1637Scheduler::poll()
 {
-    // Write COMM1
-    start();
-    writeByte(TM1637_I2C_COMM1);
-    stop();
+    char stepped = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        stepped |= displays[i]->step();
+    }
+    // One delay for all displays, their steps run interleaved
+    if (stepped)
+    {
+        _delay_us(TM1637_BIT_DELAY);
+    }
+    return stepped;
+}
 
-    // Write COMM2 + first digit address
-    start();
-    writeByte(TM1637_I2C_COMM2 + (pos & 0x03));
+// Function to send all queued frames completely
+void TM1637Scheduler::flush()
+{
+    while (poll())
+        ;
+}
 
-    // Write the data bytes
-    for (uint8_t k = 0; k < length; k++)
-        writeByte(segments[k]);
+// 7-segment font for the printable ASCII characters, starting at ' ', 0 marks a missing glyph
+static const uint8_t font[] PROGMEM = {
+    // XGFEDCBA
+    0b00000000, // ' '
+    0b00000000, // '!'
+    0b00100010, // '"'
+    0b00000000, // '#'
+    0b00000000, // '$'
+    0b00000000, // '%'
+    0b00000000, // '&'
+    0b00000010, // '\''
+    0b00111001, // '('
+    0b00001111, // ')'
+    0b00000000, // '*'
+    0b00000000, // '+'
+    0b00000000, // ','
+    0b01000000, // '-'
+    0b00000000, // '.'
+    0b01010010, // '/'
+    0b00111111, // '0'
+    0b00000110, // '1'
+    0b01011011, // '2'
+    0b01001111, // '3'
+    0b01100110, // '4'
+    0b01101101, // '5'
+    0b01111101, // '6'
+    0b00000111, // '7'
+    0b01111111, // '8'
+    0b01101111, // '9'
+    0b00000000, // ':'
+    0b00000000, // ';'
+    0b00000000, // '<'
+    0b01001000, // '='
+    0b00000000, // '>'
+    0b01010011, // '?'
+    0b00000000, // '@'
+    0b01110111, // 'A'
+    0b01111100, // 'B'
+    0b00111001, // 'C'
+    0b01011110, // 'D'
+    0b01111001, // 'E'
+    0b01110001, // 'F'
+    0b00111101, // 'G'
+    0b01110110, // 'H'
+    0b00110000, // 'I'
+    0b00011110, // 'J'
+    0b01110101, // 'K'
+    0b00111000, // 'L'
+    0b00110111, // 'M'
+    0b00110111, // 'N'
+    0b00111111, // 'O'
+    0b01110011, // 'P'
+    0b01100111, // 'Q'
+    0b01010000, // 'R'
+    0b01101101, // 'S'
+    0b01111000, // 'T'
+    0b00111110, // 'U'
+    0b00111110, // 'V'
+    0b00101010, // 'W'
+    0b01110110, // 'X'
+    0b01101110, // 'Y'
+    0b01011011, // 'Z'
+    0b00111001, // '['
+    0b01100100, // '\\'
+    0b00001111, // ']'
+    0b00100011, // '^'
+    0b00001000, // '_'
+    0b00100000, // '`'
+    0b01011111, // 'a'
+    0b01111100, // 'b'
+    0b01011000, // 'c'
+    0b01011110, // 'd'
+    0b01111011, // 'e'
+    0b01110001, // 'f'
+    0b01101111, // 'g'
+    0b01110100, // 'h'
+    0b00010000, // 'i'
+    0b00001110, // 'j'
+    0b01110101, // 'k'
+    0b00110000, // 'l'
+    0b01010100, // 'm'
+    0b01010100, // 'n'
+    0b01011100, // 'o'
+    0b01110011, // 'p'
+    0b01100111, // 'q'
+    0b01010000, // 'r'
+    0b01101101, // 's'
+    0b01111000, // 't'
+    0b00011100, // 'u'
+    0b00011100, // 'v'
+    0b00101010, // 'w'
+    0b01110110, // 'x'
+    0b01101110, // 'y'
+    0b01011011, // 'z'
+    0b00000000, // '{'
+    0b00110000, // '|'
+    0b00000000, // '}'
+    0b00000001, // '~'
+};
 
-    stop();
+static const char init_text[] PROGMEM = "InIt";
+static const char mute_text[] PROGMEM = "MutE";
 
-    // Write COMM3 + brightness
-    start();
-    writeByte(TM1637_I2C_COMM3 + (brightness & 0x0f));
-    stop();
-}
+// Segments of the digits and the fixed patterns, for builds without the text font
+static const uint8_t digit_font[] PROGMEM = {0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F};
+static const uint8_t init_frame[DISPLAY_DIGITS] PROGMEM = {0x30, 0x54, 0x30, 0x78}; // "InIt"
+static const uint8_t mute_frame[DISPLAY_DIGITS] PROGMEM = {0x37, 0x1C, 0x78, 0x79}; // "MutE"
 
 // Function to clear the TM1637 display
-void TM1637::clear()
+void TM1637Base::clear()
 {
     uint8_t data[] = {0, 0, 0, 0};
     setSegments(data, 4, 0);
 }
 
-// Function to count the number of digits in a number
-uint16_t TM1637::countDigits(uint64_t num)
+// Function to look up the glyph of a character
+char TM1637Base::glyphOf(char c, uint8_t *glyph)
 {
-    if (num / 10 == 0)
+    if (c < ' ' || c > '~')
     {
-        return 1;
+        return 0;
     }
-    return 1 + countDigits(num / 10);
+    *glyph = pgm_read_byte(&font[c - ' ']);
+    return (*glyph != 0) || (c == ' ');
+}
+
+// Function to encode a text into segments
+uint8_t TM1637Base::encodeText(const char *text, char progmem, uint8_t *segments, uint8_t width)
+{
+    uint8_t count = 0;
+    for (;; ++text)
+    {
+        char c = progmem ? (char)pgm_read_byte(text) : *text;
+        if (c == '\0')
+        {
+            return count;
+        }
+        // A point or colon belongs to the preceding glyph
+        if ((c == '.' || c == ':') && count > 0 && !(segments[count - 1] & SEG_DP))
+        {
+            segments[count - 1] |= SEG_DP;
+            continue;
+        }
+        uint8_t glyph;
+        if (count == width || !glyphOf(c, &glyph))
+        {
+            return 0xFF;
+        }
+        segments[count++] = glyph;
+    }
+}
+
+// Function to print a text right aligned in the number area
+char TM1637Base::printRight(const char *text, char colon)
+{
+    uint8_t encoded[NUM_DIGITS];
+    uint8_t count = encodeText(text, 0, encoded, NUM_DIGITS);
+    if (count == 0xFF)
+    {
+        return 0;
+    }
+    uint8_t segments[DISPLAY_DIGITS] = {0, 0, 0, 0};
+    for (uint8_t i = 0; i < count; i++)
+    {
+        segments[NUM_DIGITS - count + i] = encoded[i];
+    }
+    if (colon)
+    {
+        segments[COLON_DIGIT] |= SEG_DP;
+    }
+    setSegments(segments, DISPLAY_DIGITS, 0);
+    return 1;
 }
 
 // Function to display a number on the TM1637 display
-void TM1637::printNum(uint16_t num)
+void TM1637Base::printNum(uint16_t num)
 {
-    uint8_t digits = countDigits(num);
-    char buffer[digits + 1];
-    itoa(num, buffer, 10);
-    uint8_t segments[4] = {0, 0, 0, 0};
+    char buffer[6];
+    utoa(num, buffer, 10);
+    if constexpr (!Features::display_text)
+    {
+        // Digits only, the last NUM_DIGITS digits of a longer number
+        uint8_t segments[DISPLAY_DIGITS] = {0, 0, 0, 0};
+        for (char *p = buffer; *p; ++p)
+        {
+            pushDigit(segments, *p);
+        }
+        setSegments(segments, DISPLAY_DIGITS, 0);
+        return;
+    }
+    printRight(buffer, 0);
+}
 
-    for (uint8_t i = 0; i < digits; i++)
+// Function to display a formatted number on the TM1637 display
+char TM1637Base::printFormatted(int16_t num, uint8_t decimals, char colon)
+{
+    if constexpr (!Features::display_text)
+    {
+        return 0;
+    }
+    // Sign, 5 digits, leading zero, point and terminator
+    char buffer[9];
+    char *p = buffer;
+    uint16_t magnitude = (num < 0) ? (uint16_t)(-(int32_t)num) : (uint16_t)num;
+    if (num < 0)
+    {
+        *p++ = '-';
+    }
+    char digits[6];
+    utoa(magnitude, digits, 10);
+    uint8_t length = strlen(digits);
+    if (decimals > 5)
+    {
+        return 0;
+    }
+    // Pad with zeros, so there is at least one digit in front of the point
+    uint8_t padded = (length > decimals) ? length : decimals + 1;
+    uint8_t zeros = padded - length;
+    for (uint8_t i = 0; i < padded; i++)
+    {
+        if (decimals > 0 && padded - i == decimals)
+        {
+            *p++ = '.';
+        }
+        *p++ = (i < zeros) ? '0' : digits[i - zeros];
+    }
+    *p = '\0';
+    return printRight(buffer, colon);
+}
+
+// Function to display a text on the TM1637 display
+char TM1637Base::printText(const char *text)
+{
+    if constexpr (!Features::display_text)
+    {
+        return 0;
+    }
+    uint8_t segments[DISPLAY_DIGITS] = {0, 0, 0, 0};
+    if (encodeText(text, 0, segments, DISPLAY_DIGITS) == 0xFF)
     {
-        segments[3 - i - NUM_OFFSET] = num_2_digit[buffer[digits - 1 - i] - '0'];
+        return 0;
     }
-    setSegments(segments, 4, 0);
+    setSegments(segments, DISPLAY_DIGITS, 0);
+    return 1;
+}
+
+// Function to display a text stored in flash on the TM1637 display
+char TM1637Base::printText_P(PGM_P text)
+{
+    if constexpr (!Features::display_text)
+    {
+        return 0;
+    }
+    uint8_t segments[DISPLAY_DIGITS] = {0, 0, 0, 0};
+    if (encodeText(text, 1, segments, DISPLAY_DIGITS) == 0xFF)
+    {
+        return 0;
+    }
+    setSegments(segments, DISPLAY_DIGITS, 0);
+    return 1;
 }
 
 // Function to display a string of digits on the TM1637 display
-void TM1637::printNumChar(const char *str, uint8_t digits)
+char TM1637Base::printNumChar(const char *str, uint8_t digits)
 {
-    uint8_t segments[4] = {0, 0, 0, 0};
+    uint8_t segments[DISPLAY_DIGITS] = {0, 0, 0, 0};
 
+    if (digits > NUM_DIGITS)
+    {
+        return 0;
+    }
     for (uint8_t i = 0; i < digits; i++)
     {
-        segments[3 - i - NUM_OFFSET] = num_2_digit[str[digits - 1 - i] - '0'];
+        if (!pushDigit(segments, str[i]))
+        {
+            return 0;
+        }
     }
-    setSegments(segments, 4, 0);
+    setSegments(segments, DISPLAY_DIGITS, 0);
+    return 1;
+}
+
+// Function to shift an encoded digit into a segment frame
+char TM1637Base::pushDigit(uint8_t *frame, char c)
+{
+    // Only digits are accepted, everything else is rejected
+    if (c < '0' || c > '9')
+    {
+        return 0;
+    }
+    for (uint8_t i = 0; i < NUM_DIGITS - 1; i++)
+    {
+        frame[i] = frame[i + 1];
+    }
+    if constexpr (Features::display_text)
+    {
+        frame[NUM_DIGITS - 1] = pgm_read_byte(&font[c - ' ']);
+    }
+    else
+    {
+        frame[NUM_DIGITS - 1] = pgm_read_byte(&digit_font[c - '0']);
+    }
+    return 1;
+}
+
+// Function to display an encoded segment frame on the TM1637 display
+void TM1637Base::printFrame(const uint8_t *frame)
+{
+    setSegments(frame, DISPLAY_DIGITS, 0);
 }
 
 // Function to display an initialization pattern on the TM1637 display
-void TM1637::printInit()
+void TM1637Base::printInit()
 {
-    uint8_t segments[] = {0b00110000, 0b01010100, 0b00110000, 0b01111000};
-    setSegments(segments, 4, 0);
+    if constexpr (Features::display_text)
+    {
+        printText_P(init_text);
+    }
+    else
+    {
+        printPattern(init_frame);
+    }
 }
 
 // Function to display a mute pattern on the TM1637 display
-void TM1637::printMute()
+void TM1637Base::printMute()
+{
+    if constexpr (Features::display_text)
+    {
+        printText_P(mute_text);
+    }
+    else
+    {
+        printPattern(mute_frame);
+    }
+}
+
+// Function to display a segment frame stored in flash
+void TM1637Base::printPattern(const uint8_t *frame)
 {
-    uint8_t segments[] = {0b00110111, 0b00011100, 0b01111000, 0b01111001};
-    setSegments(segments, 4, 0);
-}
\ No newline at end of file
+    uint8_t segments[DISPLAY_DIGITS];
+    for (uint8_t i = 0; i < DISPLAY_DIGITS; i++)
+    {
+        segments[i] = pgm_read_byte(&frame[i]);
+    }
+    setSegments(segments, DISPLAY_DIGITS, 0);
+}
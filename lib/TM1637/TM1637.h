@@ -23,72 +23,171 @@
 #include <util/delay.h>
 #include <stdlib.h>
 #include <avr/io.h>
-
-#define CLK PORTD5
-#define DIO PORTD6
+#include <avr/pgmspace.h>
+#include "Features.h"
 
 #define TM1637_I2C_COMM1 0x40
 #define TM1637_I2C_COMM2 0xC0
 #define TM1637_I2C_COMM3 0x80
 
 #define NUM_OFFSET 1
+#define DISPLAY_DIGITS 4 // Number of digits of the display
+#define NUM_DIGITS (DISPLAY_DIGITS - NUM_OFFSET) // Number of digits usable for numbers
+#define SEG_DP 0x80 // Decimal point segment (colon on the second digit)
+#define COLON_DIGIT 1 // Digit whose SEG_DP segment drives the colon
+
+#define TM1637_BIT_DELAY 100 // Delay between two bus steps in microseconds
+#define TM1637_MAX_FRAME (DISPLAY_DIGITS + 3) // Bytes of one frame (3 commands and the segments)
+#define TM1637_MAX_DISPLAYS 4 // Number of displays a TM1637Scheduler can drive
 
 /**
- * @brief TM1637 display driver class
+ * @brief Port access for the TM1637 bus
+ * 
+ * @details The bus lines are open drain: a line is pulled low by switching its pin to
+ * output (PORT bit stays 0) and released high by switching it to input. With the pin
+ * masks known at compile time every access compiles to a single sbi/cbi/sbic.
  */
-class TM1637
-{
-    // Bit delay for communication
-    static const uint16_t bit_delay = 100;
-    // Brightness level of the display
-    uint8_t brightness = 12;
-    // Array to map numbers to their corresponding 7-segment display encoding
-    uint8_t num_2_digit[10]{
-        // XGFEDCBA
-        0b00111111, // 0
-        0b00000110, // 1
-        0b01011011, // 2
-        0b01001111, // 3
-        0b01100110, // 4
-        0b01101101, // 5
-        0b01111101, // 6
-        0b00000111, // 7
-        0b01111111, // 8
-        0b01101111  // 9
+#define TM1637_PORT(name, ddr, pin)                  \
+    struct name                                      \
+    {                                                \
+        static inline void pullLow(uint8_t mask)     \
+        {                                            \
+            ddr |= mask;                             \
+        }                                            \
+        static inline void release(uint8_t mask)     \
+        {                                            \
+            ddr &= ~mask;                            \
+        }                                            \
+        static inline uint8_t read(uint8_t mask)     \
+        {                                            \
+            return pin & mask;                       \
+        }                                            \
     };
 
+TM1637_PORT(TM1637PortB, DDRB, PINB)
+TM1637_PORT(TM1637PortC, DDRC, PINC)
+TM1637_PORT(TM1637PortD, DDRD, PIND)
+
+/**
+ * @brief TM1637 display driver base class
+ * 
+ * @details This class holds everything that does not depend on the pins: the font,
+ * the text rendering and the bus state machine state. Printing never blocks, the
+ * frame is only queued and sent step by step by step(), which the TM1637 template
+ * implements for its pins. A frame queued while another one is being sent replaces
+ * any older queued frame, so the display always ends up showing the newest one.
+ */
+class TM1637Base
+{
     /**
-     * @brief Function to start communication with TM1637
+     * @brief Function to look up the glyph of a character
      * 
-     * @details This function sets the DIO and CLK lines high, then sets the DIO line low
-     * to start communication with the TM1637 display.
+     * @details This function reads the 7-segment encoding of the character from
+     * the flash-resident font.
+     * 
+     * @param c Character to look up
+     * @param glyph Pointer to store the encoding
+     * @return char 1 if the font contains the character, 0 otherwise
      */
-    void start();
+    static char glyphOf(char c, uint8_t *glyph);
 
     /**
-     * @brief Function to stop communication with TM1637
+     * @brief Function to encode a text into segments
+     * 
+     * @details This function encodes the text left aligned into the segments. A '.'
+     * or ':' sets SEG_DP of the preceding glyph instead of taking a digit.
      * 
-     * @details This function sets the CLK line low, then sets the DIO line low, and finally
-     * sets both the CLK and DIO lines high to stop communication with the TM1637 display.
+     * @param text Text to encode, in RAM or in flash
+     * @param progmem 1 if the text is stored in flash
+     * @param segments Segments to encode into
+     * @param width Number of available segments
+     * @return uint8_t Number of used segments, or 0xFF if the text was rejected
+     */
+    static uint8_t encodeText(const char *text, char progmem, uint8_t *segments, uint8_t width);
+
+    /**
+     * @brief Function to print a text right aligned in the number area
+     * 
+     * @param text Text to print
+     * @param colon 1 to light the colon
+     * @return char 1 if the text was printed, 0 if it was rejected
+     */
+    char printRight(const char *text, char colon);
+
+    /**
+     * @brief Function to print a segment frame stored in flash
+     * 
+     * @details Builds without the text font print the fixed patterns with this function.
+     * 
+     * @param frame DISPLAY_DIGITS segment bytes in flash
+     */
+    void printPattern(const uint8_t *frame);
+
+    // Queued frame
+    uint8_t pending[TM1637_MAX_FRAME];
+    // Length of the queued frame, 0 if none
+    uint8_t pending_length = 0;
+
+protected:
+    /**
+     * @brief States of the bus state machine
      */
-    void stop();
+    enum BusState : uint8_t
+    {
+        BUS_IDLE, ///< No frame is being sent
+        BUS_START, ///< Start condition
+        BUS_BYTE, ///< Data bits and acknowledge of a byte
+        BUS_STOP ///< Stop condition
+    };
+
+    // Brightness level of the display
+    uint8_t brightness = 12;
+    // Frame being sent
+    uint8_t tx[TM1637_MAX_FRAME];
+    // Length of the frame being sent
+    uint8_t tx_length = 0;
+    // State of the bus state machine
+    BusState bus_state = BUS_IDLE;
+    // Index of the byte being sent
+    uint8_t bus_byte = 0;
+    // Remaining bits of the byte being sent
+    uint8_t bus_data = 0;
+    // Bit of the byte being sent (8 for the acknowledge)
+    uint8_t bus_bit = 0;
+    // Step within the current bit, start or stop condition
+    uint8_t bus_sub = 0;
 
     /**
-     * @brief Function to write a byte to TM1637
+     * @brief Function to start sending the queued frame
      * 
-     * @details This function writes a byte to the TM1637 display by sending each bit
-     * and toggling the CLK line. It also waits for an acknowledgment from the display.
+     * @return char 1 if a frame was queued, 0 otherwise
+     */
+    char loadPending();
+
+    /**
+     * @brief Function to start sending the current byte
+     */
+    void beginByte();
+
+    /**
+     * @brief Function to advance to the next byte after an acknowledge
      * 
-     * @param b Byte to write
+     * @details The frame is sent as three transactions (COMM1, COMM2 with the
+     * segments, COMM3 with the brightness), so a stop condition follows the first,
+     * the second to last and the last byte.
+     */
+    void nextByte();
+
+    /**
+     * @brief Function to continue after a stop condition
      */
-    void writeByte(uint8_t b);
+    void finishStop();
 
     /**
      * @brief Function to set segments on the TM1637 display
      * 
-     * @details This function sets the segments on the TM1637 display by sending the
-     * appropriate commands and data. It can set multiple segments starting from a
-     * specified position.
+     * @details This function queues the commands and data that set the segments on the
+     * TM1637 display. It can set multiple segments starting from a specified position.
      * 
      * @param segments Array of segments to set
      * @param length Length of the segments array
@@ -96,18 +195,36 @@ class TM1637
      */
     void setSegments(const uint8_t *segments, uint8_t length, uint8_t pos);
 
+public:
     /**
-     * @brief Function to count the number of digits in a number
+     * @brief Function to perform one bus step
      * 
-     * @details This function counts the number of digits in a given number by
-     * recursively dividing the number by 10.
+     * @details This function changes the bus lines for the next step of the frame being
+     * sent (or starts the queued frame). The caller must wait TM1637_BIT_DELAY before the
+     * next step, TM1637Scheduler does that for several displays at once.
      * 
-     * @param num Number to count digits of
-     * @return uint16_t Number of digits
+     * @return char 1 if a step was performed, 0 if the display is idle
      */
-    uint16_t countDigits(uint64_t num);
+    virtual char step() = 0;
+
+    /**
+     * @brief Function to check if a frame is being sent or queued
+     * 
+     * @return char 1 if the display is busy, 0 otherwise
+     */
+    char busy() const
+    {
+        return bus_state != BUS_IDLE || pending_length != 0;
+    }
+
+    /**
+     * @brief Function to send the queued frame completely
+     * 
+     * @details This function blocks until the display is idle, it is needed where the
+     * frame must be visible before continuing (e.g. before a watchdog reset).
+     */
+    void flush();
 
-public:
     /**
      * @brief Function to clear the TM1637 display
      * 
@@ -130,25 +247,241 @@ public:
      * 
      * @details This function prints a given buffer of characters on the TM1637 display.
      * It converts each character to its corresponding 7-segment display encoding and sets
-     * the segments.
+     * the segments. The buffer is rejected and the display left untouched if it contains
+     * a character other than a digit or does not fit on the display.
      * 
      * @param buffer Buffer containing the characters to print
      * @param length Length of the buffer
+     * @return char 1 if the buffer was printed, 0 if it was rejected
      */
-    void printNumChar(const char *buffer, uint8_t length);
+    char printNumChar(const char *buffer, uint8_t length);
+
+    /**
+     * @brief Function to encode a digit character into a segment frame
+     * 
+     * @details This function converts the digit character to its 7-segment display
+     * encoding and shifts it into the number area of the frame from the right, so
+     * that a number received digit by digit ends up right aligned exactly as
+     * printNumChar would render it. The frame can be printed with printFrame.
+     * 
+     * @param frame Frame of DISPLAY_DIGITS segments to shift the digit into
+     * @param c Digit character to encode
+     * @return char 1 if the character was a digit, 0 if it was rejected
+     */
+    char pushDigit(uint8_t *frame, char c);
+
+    /**
+     * @brief Function to print a segment frame on the display
+     * 
+     * @details This function sends an already encoded frame of DISPLAY_DIGITS segments
+     * to the TM1637 display without any conversion.
+     * 
+     * @param frame Frame of DISPLAY_DIGITS segments to print
+     */
+    void printFrame(const uint8_t *frame);
+
+    /**
+     * @brief Function to print a text on the display
+     * 
+     * @details This function renders the text left aligned in one transaction using the
+     * flash-resident font (digits, letters and a few symbols). Builds without
+     * Features::display_text have no font and reject every text. A '.' or ':' lights the
+     * decimal point of the preceding character. The text is rejected and the display left
+     * untouched if it contains a character missing in the font or does not fit on the display.
+     * 
+     * @param text Text to print
+     * @return char 1 if the text was printed, 0 if it was rejected
+     */
+    char printText(const char *text);
+
+    /**
+     * @brief Function to print a text stored in flash on the display
+     * 
+     * @details Same as printText, for texts declared with PROGMEM or PSTR.
+     * 
+     * @param text Text to print, stored in flash
+     * @return char 1 if the text was printed, 0 if it was rejected
+     */
+    char printText_P(PGM_P text);
+
+    /**
+     * @brief Function to print a formatted number on the display
+     * 
+     * @details This function renders a signed number right aligned in the number area,
+     * like printNum, with an optional decimal point and the colon in one transaction.
+     * Builds without Features::display_text reject every number.
+     * 
+     * @param num Number to print
+     * @param decimals Number of digits behind the decimal point
+     * @param colon 1 to light the colon
+     * @return char 1 if the number was printed, 0 if it does not fit
+     */
+    char printFormatted(int16_t num, uint8_t decimals = 0, char colon = 0);
 
     /**
      * @brief Function to initialize the display
      * 
-     * @details This function initializes the TM1637 display by clearing all segments.
+     * @details This function prints "InIt" on the TM1637 display.
      */
     void printInit();
 
     /**
      * @brief Function to print "MUTE" on the display
      * 
-     * @details This function prints the word "MUTE" on the TM1637 display by setting the
-     * appropriate segments for each character.
+     * @details This function prints "MutE" on the TM1637 display.
      */
     void printMute();
-};
\ No newline at end of file
+};
+
+/**
+ * @brief TM1637 display driver class
+ * 
+ * @details The bus state machine is specialized for the port and pins at compile time,
+ * so every line change is a single sbi/cbi instruction and several displays can share
+ * one TM1637Scheduler. Example: TM1637<TM1637PortD, PORTD5, PORTD6> for CLK on PD5 and
+ * DIO on PD6.
+ * 
+ * @tparam Port Port access (TM1637PortB, TM1637PortC or TM1637PortD)
+ * @tparam ClkBit Pin of the CLK line
+ * @tparam DioBit Pin of the DIO line
+ */
+template <class Port, uint8_t ClkBit, uint8_t DioBit>
+class TM1637 : public TM1637Base
+{
+    static const uint8_t CLK_MASK = 1 << ClkBit;
+    static const uint8_t DIO_MASK = 1 << DioBit;
+
+public:
+    // Function to perform one bus step
+    char step() override
+    {
+        switch (bus_state)
+        {
+        case BUS_IDLE:
+            if (!loadPending())
+            {
+                return 0;
+            }
+            // fall through
+        case BUS_START:
+            // DIO low while CLK is released
+            Port::pullLow(DIO_MASK);
+            beginByte();
+            return 1;
+
+        case BUS_BYTE:
+            if (bus_bit < 8)
+            {
+                if (bus_sub == 0)
+                {
+                    // CLK low
+                    Port::pullLow(CLK_MASK);
+                }
+                else if (bus_sub == 1)
+                {
+                    // Set data bit
+                    if (bus_data & 0x01)
+                        Port::release(DIO_MASK);
+                    else
+                        Port::pullLow(DIO_MASK);
+                }
+                else
+                {
+                    // CLK high
+                    Port::release(CLK_MASK);
+                    bus_data >>= 1;
+                    bus_bit++;
+                    bus_sub = 0;
+                    return 1;
+                }
+                bus_sub++;
+                return 1;
+            }
+            // Wait for acknowledge
+            if (bus_sub == 0)
+            {
+                // CLK to zero, release DIO
+                Port::pullLow(CLK_MASK);
+                Port::release(DIO_MASK);
+            }
+            else if (bus_sub == 1)
+            {
+                // CLK to high
+                Port::release(CLK_MASK);
+            }
+            else if (bus_sub == 2)
+            {
+                if (Port::read(DIO_MASK) == 0)
+                    Port::pullLow(DIO_MASK);
+            }
+            else
+            {
+                // CLK low
+                Port::pullLow(CLK_MASK);
+                nextByte();
+                return 1;
+            }
+            bus_sub++;
+            return 1;
+
+        case BUS_STOP:
+            if (bus_sub == 0)
+            {
+                // DIO low
+                Port::pullLow(DIO_MASK);
+            }
+            else if (bus_sub == 1)
+            {
+                // CLK high
+                Port::release(CLK_MASK);
+            }
+            else
+            {
+                // DIO high
+                Port::release(DIO_MASK);
+                finishStop();
+                return 1;
+            }
+            bus_sub++;
+            return 1;
+        }
+        return 0;
+    }
+};
+
+/**
+ * @brief Bus scheduler for several TM1637 displays
+ * 
+ * @details Every poll performs one step on each busy display and then waits a single
+ * TM1637_BIT_DELAY, so the frames of all displays are sent interleaved and none of them
+ * waits for another one to finish. The main loop is blocked for one bit delay per poll
+ * instead of for whole frames.
+ */
+class TM1637Scheduler
+{
+    // Registered displays
+    TM1637Base *displays[TM1637_MAX_DISPLAYS];
+    // Number of registered displays
+    uint8_t count = 0;
+
+public:
+    /**
+     * @brief Function to register a display
+     * 
+     * @param display Display to register, registering it again has no effect
+     * @return char 1 if the display is registered, 0 if the scheduler is full
+     */
+    char add(TM1637Base &display);
+
+    /**
+     * @brief Function to advance all displays by one step
+     * 
+     * @return char 1 if any display is still busy, 0 if all are idle
+     */
+    char poll();
+
+    /**
+     * @brief Function to send all queued frames completely
+     */
+    void flush();
+};
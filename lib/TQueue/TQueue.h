@@ -175,6 +175,73 @@ static inline struct TQueueIterator queue_find_if_not(struct TQueueIterator aIte
 	return aIter;
 	}
 
+#ifdef __cplusplus
+/** \brief Zavolání zvolené operace na každý element fronty od pozice určené iterátorem až do konce fronty.
+ *  \details Šablonová varianta funkce queue_for_each(). Operace \p aOperation (funkce, funktor nebo lambda výraz) dostává referenci na element fronty,
+ *  takže jej může i měnit. Kruhové pole je procházeno jako nejvýše dva souvislé úseky (od iterátoru do konce pole a od začátku pole do konce fronty),
+ *  bez volání queue_iterator_is_valid() a operace modulo pro každý element, a překladač může operaci vložit (inline).
+ *  \param[in] aIter Hodnota existujícího iterátoru, jenž je předem asociovaný se zvolenou frontou a který tak definuje počáteční element pro zvolenou operaci
+ *  \param[in] aOperation Operace volaná s parametrem typu \c TQueueElement&
+ */
+template <typename TOperation>
+static inline void queue_for_each_value(struct TQueueIterator aIter, TOperation aOperation)
+	{
+	if(!queue_iterator_is_valid(&aIter))
+		return;
+	TQueueElement *values = ((struct TQueue *)aIter.iQueue)->iValues;
+	const size_t end = aIter.iQueue->iPushPos;
+	size_t pos = aIter.iPos;
+	if(pos > end)
+		{
+		for(; pos < QUEUE_MAXCOUNT; ++pos)
+			aOperation(values[pos]);
+		pos = 0;
+		}
+	for(; pos < end; ++pos)
+		aOperation(values[pos]);
+	}
+
+/** \brief Vyhledání prvního elementu fronty splňujícího zadaný predikát
+ *  \details Šablonová varianta funkce queue_find_if(). Predikát \p aPredicate (funkce, funktor nebo lambda výraz) dostává hodnotu elementu fronty.
+ *  Kruhové pole je procházeno jako nejvýše dva souvislé úseky a překladač může predikát vložit (inline).
+ *  \param[in] aIter Hodnota existujícího iterátoru, jenž je předem asociovaný se zvolenou frontou a který tak definuje počáteční element pro zvolenou operaci
+ *  \param[in] aPredicate Predikát volaný s parametrem typu \c TQueueElement a vracející hodnotu převoditelnou na \c bool
+ *  \return Hodnota iterátoru ukazujícího na první nalezený element fronty splňující zadaný predikát \p aPredicate, nebo neplatný iterátor, pokud nebyl nalezen žádný vhodný element.
+ */
+template <typename TPredicate>
+static inline struct TQueueIterator queue_find_if_value(struct TQueueIterator aIter, TPredicate aPredicate)
+	{
+	if(queue_iterator_is_valid(&aIter))
+		{
+		const TQueueElement *values = aIter.iQueue->iValues;
+		const size_t end = aIter.iQueue->iPushPos;
+		if(aIter.iPos > end)
+			{
+			for(; aIter.iPos < QUEUE_MAXCOUNT; ++aIter.iPos)
+				if(aPredicate(values[aIter.iPos]))
+					return aIter;
+			aIter.iPos = 0;
+			}
+		for(; aIter.iPos < end; ++aIter.iPos)
+			if(aPredicate(values[aIter.iPos]))
+				return aIter;
+		}
+	return (struct TQueueIterator){.iQueue = NULL, .iPos = 0};
+	}
+
+/** \brief Vyhledání prvního elementu fronty nesplňujícího zadaný predikát
+ *  \details Šablonová varianta funkce queue_find_if_not(), viz queue_find_if_value().
+ *  \param[in] aIter Hodnota existujícího iterátoru, jenž je předem asociovaný se zvolenou frontou a který tak definuje počáteční element pro zvolenou operaci
+ *  \param[in] aPredicate Predikát volaný s parametrem typu \c TQueueElement a vracející hodnotu převoditelnou na \c bool
+ *  \return Hodnota iterátoru ukazujícího na první nalezený element fronty nesplňující zadaný predikát \p aPredicate, nebo neplatný iterátor, pokud nebyl nalezen žádný vhodný element.
+ */
+template <typename TPredicate>
+static inline struct TQueueIterator queue_find_if_not_value(struct TQueueIterator aIter, TPredicate aPredicate)
+	{
+	return queue_find_if_value(aIter, [&aPredicate](TQueueElement aValue) { return !aPredicate(aValue); });
+	}
+#endif /* __cplusplus */
+
 /** \} IteratorAlgoritms */
 
 #endif /* TQUEUE_H */
@@ -0,0 +1,70 @@
+/*
+ * This file is part of the SPC_2024_project_embed project.
+ *
+ * Copyright (C) 2024 Martin Stieber, Jan Lána
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define VOLUME_CURVE_SHIFT 2 // Right shift of a 10-bit value to the table index
+#define VOLUME_CURVE_SIZE (1024 >> VOLUME_CURVE_SHIFT) // Number of entries of a table
+#define VOLUME_MAX 100 // Highest volume step
+
+/**
+ * @brief Response curves of the volume mapping
+ */
+enum VolumeCurveId : uint8_t
+{
+    CURVE_LINEAR, ///< Volume proportional to the knob position
+    CURVE_LOG, ///< Audio taper, 101^x - 1, fine steps at low volume
+    CURVE_CUSTOM, ///< Project specific table, linear with dead zones at both end stops
+    CURVE_COUNT ///< Number of curves
+};
+
+/**
+ * @brief Flash-resident volume response curves
+ * 
+ * @details A curve maps a filtered 10-bit value to a volume step from 0 to VOLUME_MAX
+ * with a table of VOLUME_CURVE_SIZE bytes in flash, indexed by the value shifted
+ * right by VOLUME_CURVE_SHIFT. The custom table may be replaced by any monotonic
+ * table of the same size.
+ */
+class VolumeCurve
+{
+public:
+    /**
+     * @brief Function to get the table of a curve
+     * 
+     * @param curve Curve
+     * @return const uint8_t* Table in flash, nullptr for an unknown curve
+     */
+    static const uint8_t *table(uint8_t curve);
+
+    /**
+     * @brief Function to map a value through a table
+     * 
+     * @param table Table in flash returned by table()
+     * @param value Value from 0 to 1023
+     * @return uint8_t Volume step from 0 to VOLUME_MAX
+     */
+    static inline uint8_t map(const uint8_t *table, uint16_t value)
+    {
+        return pgm_read_byte(&table[(value >> VOLUME_CURVE_SHIFT) & (VOLUME_CURVE_SIZE - 1)]);
+    }
+};
@@ -21,25 +21,56 @@
 #include <avr/interrupt.h>
 #include <util/delay.h>
 #include <avr/wdt.h>
-#include "Serial.h"
-#include "TM1637.h"
-
-#define INT_PIN PCINT21
+#include "Firmware.h"
+#include "MemMonitor.h"
+#include "Clock.h"
+#include "MicroBench.h"
+#include "Profiler.h"
 
 /**
- * @brief Global variables for mute state and ADC value
+ * @brief State shared with the interrupts, each has a single writer ISR
  */
-volatile char is_muted = 0; ///< Mute state flag
-volatile char unmute_handled = 1; ///< Unmute handled flag
-volatile char mute_handled = 0; ///< Mute handled flag
+Mailbox<uint16_t> adc_mailbox; ///< Newest ADC value
+Mailbox<char> mute_mailbox; ///< Mute state set by the button
 
-volatile uint16_t adc_val = 0; ///< ADC value
-volatile char new_adc_val = 0; ///< New ADC value flag
+static char is_muted = 0; ///< Mute state handled by the main loop
 
 /**
  * @brief Initialize Serial communication with baud rate 57600, median filter size 21, and sending bias 1
  */
-Serial serial(57600, 21, 1, 1);
+Serial serial(SERIAL_BAUDRATE, MEDIAN_FILTER_SIZE, SENDING_BIAS, DOUBLE_SPEED);
+
+/**
+ * @brief TM1637 display and main loop state
+ */
+VolumeDisplay display; ///< Volume display
+TM1637Scheduler display_bus; ///< Bus scheduler of all displays
+AdcCapture capture; ///< Raw ADC capture
+SignalGen signal_gen; ///< Input source of the ADC interrupt
+Keys keys; ///< Media keys on the pin change interrupt
+NoiseTuner tuner; ///< Median filter tuning to the measured noise
+MainState main_state = STATE_HANDSHAKE; ///< Main loop state
+
+static char display_change = 0; ///< Shown frame changed flag
+static char local_display = LOCAL_DISPLAY; ///< The device renders the volume itself
+static char local_override = 0; ///< A host line overrides the local display
+static uint32_t override_until = 0; ///< Device time the override ends
+
+// Two cached segment frames, digits are encoded into the back frame as they
+// arrive and a complete line only flips the index of the shown frame
+static uint8_t frames[2][DISPLAY_DIGITS]; ///< Cached segment frames
+static uint8_t shown_frame = 0; ///< Index of the shown frame
+static uint8_t rx_digits = 0; ///< Digits received on the current line
+static char rx_valid = 1; ///< Current line is valid flag
+static uint8_t stable_samples = 0; ///< Consecutive samples without a report
+static char idle_sampling = 0; ///< The main loop starts the conversions at the idle rate
+static uint32_t next_idle_sample = 0; ///< Device time of the next idle conversion
+static char curve_handshake = 0; ///< 'v' received, the curve digit follows
+
+// Commands with arguments collect the rest of their line before they run
+static char line_command = 0; ///< Command collecting its line, 0 for none
+static char line[COMMAND_LINE_MAX + 1]; ///< Arguments of the line command
+static uint8_t line_length = 0; ///< Length of the arguments
 
 /**
  * @brief Function to initialize ADC
@@ -65,8 +96,8 @@ void ADC_Init()
  * @brief Function to initialize Timer0
  * 
  * @details This function sets Timer0 to CTC mode, sets the prescaler to 1024,
- * and sets the compare value for approximately 10ms interval. It also disables
- * Timer0 interrupts.
+ * and sets the compare value for the sampling period (approximately 10ms).
+ * It also disables Timer0 interrupts.
  */
 void Timer0_Init()
 {
@@ -75,11 +106,41 @@ void Timer0_Init()
     // Set prescaler to 1024
     TCCR0B = (1 << CS02) | (1 << CS00);
     // Set compare value for ~10ms interval
-    OCR0A = (unsigned char)156;
+    OCR0A = (unsigned char)SAMPLE_PERIOD;
     // Disable Timer0 interrupts
     TIMSK0 = 0;
 }
 
+/**
+ * @brief Function to switch between the Timer0 and the idle sampling rate
+ * 
+ * @details At the idle rate the Timer0 auto trigger is turned off and the main
+ * loop starts a single conversion every IDLE_SAMPLE_US, so the conversions and
+ * the ADC interrupt slow down as well. Leaving the idle rate restarts Timer0, so
+ * the next conversion follows one SAMPLE_PERIOD later. The write keeps ADIF, a
+ * finished conversion is not lost while interrupts are disabled.
+ * 
+ * @param idle 1 for the idle rate, 0 for the Timer0 rate
+ */
+static void set_idle_sampling(char idle)
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (idle)
+    {
+        ADCSRA = ADCSRA & ~((1 << ADATE) | (1 << ADIF));
+        next_idle_sample = Clock::micros() + IDLE_SAMPLE_US;
+    }
+    else
+    {
+        TCNT0 = 0;
+        TIFR0 |= (1 << OCF0A);
+        ADCSRA = (ADCSRA & ~(1 << ADIF)) | (1 << ADATE);
+    }
+    idle_sampling = idle;
+    SREG = sreg;
+}
+
 /**
  * @brief Inline function to check if ADC value is within range
  * 
@@ -111,20 +172,38 @@ void MUTE_Init()
 }
 
 /**
- * @brief ADC interrupt service routine
+ * @brief Function to take one converted sample
  * 
- * @details This ISR reads the ADC value, sets the flag for new value, and
- * clears the Timer0 compare match flag.
+ * @details This function reads the ADC value, or the generated sample when a
+ * signal generator is selected, posts it to the main loop and clears the Timer0
+ * compare match flag. In capture mode the sample is only stored into the capture
+ * buffers. It is the body of the ADC interrupt, kept apart so the benchmark times
+ * it without the vector, whose reti would enable interrupts.
  */
-ISR(ADC_vect)
+static inline void adc_sample()
 {
-    // Read ADC value and set flag for new value
-    adc_val = ADC;
-    new_adc_val = 1;
+    uint16_t sample = Features::signal_gen ? signal_gen.next(ADC) : ADC;
+    if (Features::capture && capture.isActive())
+    {
+        capture.push(sample);
+        return;
+    }
+    // Post the sample to the main loop
+    adc_mailbox.post(sample);
     // Clear Timer0 compare match flag
     TIFR0 |= (1 << OCF0A);
 }
 
+/**
+ * @brief ADC interrupt service routine
+ * 
+ * @details This ISR takes the converted sample.
+ */
+ISR(ADC_vect)
+{
+    adc_sample();
+}
+
 /**
  * @brief INT0 interrupt service routine
  * 
@@ -133,146 +212,698 @@ ISR(ADC_vect)
  */
 ISR(INT0_vect)
 {
-    // Toggle PB5 and update mute state
+    // Toggle PB5 and the mute state
     PORTB ^= (1 << PB5);
-    is_muted = !is_muted;
-    if (is_muted)
-    {
-        mute_handled = 0;
-    }
-    else
-    {
-        unmute_handled = 0;
-    }
+    mute_mailbox.post(!mute_mailbox.peek());
 }
 
 /**
- * @brief Main function
+ * @brief Pin change interrupt service routine of port D
  * 
- * @details This is the main function of the program. It initializes the
- * TM1637 display, disables global interrupts, initializes pins and peripherals,
- * enables global interrupts, performs a handshake with serial communication,
- * and enters the main loop where it handles mute/unmute functionality, ADC
- * value processing, and serial communication.
+ * @details This ISR stamps the first edge of a key and restarts the debounce time.
+ */
+#if FEATURE_KEYS
+ISR(PCINT2_vect)
+{
+    keys.onPinChange();
+}
+
+/**
+ * @brief Timer1 compare match B interrupt service routine
  * 
- * @return int 
+ * @details This ISR fires once the key pins were quiet for the debounce time and
+ * queues the settled key changes.
  */
-int main(void)
+ISR(TIMER1_COMPB_vect)
+{
+    keys.onDebounce();
+}
+#endif
+
+// Function to initialize the firmware
+void firmware_init()
 {
+    // Reset the main loop state
+    is_muted = 0;
+    adc_mailbox.reset(0);
+    mute_mailbox.reset(0);
+    main_state = STATE_HANDSHAKE;
+    display_change = 0;
+    local_display = LOCAL_DISPLAY;
+    local_override = 0;
+    for (uint8_t i = 0; i < DISPLAY_DIGITS; ++i)
+    {
+        frames[0][i] = 0;
+        frames[1][i] = 0;
+    }
+    shown_frame = 0;
+    rx_digits = 0;
+    rx_valid = 1;
+    stable_samples = 0;
+    // ADC_Init() enables the Timer0 auto trigger again
+    idle_sampling = 0;
+    curve_handshake = 0;
+    serial.setCurve(nullptr);
+    line_command = 0;
+    line_length = 0;
+    if constexpr (Features::signal_gen)
+    {
+        signal_gen.select(SIGNAL_SOURCE);
+    }
+    if constexpr (Features::noise_tuning)
+    {
+        // Start with the filter tuned before the reset
+        tuner.init(TUNE_WINDOW_MIN, MEDIAN_FILTER_SIZE, SENDING_BIAS, TUNE_BIAS_MAX, MEDIAN_FILTER_SIZE, SENDING_BIAS);
+        serial.setFilter(tuner.filterWindow(), tuner.sendingBias());
+    }
+
     // Initialize TM1637 display
-    TM1637 display;
+    display_bus.add(display);
     display.printInit();
     // Disable global interrupts at the beginning
     cli();
 
     // Initialize pins
-    DDRD &= ~(1 << PD7);
     DDRB = (1 << PB5);
     PORTB &= ~(1 << PB5);
 
     // Initialize all peripherals
     ADC_Init();
     Timer0_Init();
+    Clock::init();
+    if constexpr (Features::keys)
+    {
+        static const uint8_t key_pins[] = {KEY_PLAY, KEY_NEXT, KEY_PREVIOUS};
+        keys.init(key_pins, sizeof(key_pins));
+    }
+    if constexpr (Features::profiling)
+    {
+        Profiler::start();
+    }
 
     // Enable global interrupts
     sei();
+}
 
-    // Handshake with serial communication
-    char welcome = 0;
-    do
+/**
+ * @brief Function to answer a ping
+ * 
+ * @details This function echoes the token of the ping with the device time at which
+ * the end of the ping line was parsed and the device time at which the reply starts:
+ * "p<token>,<rx time>,<tx time>\n".
+ * 
+ * @param rx_time Device time of the end of the ping line in microseconds
+ */
+static void answer_ping(uint32_t rx_time)
+{
+    char buffer[11]; // Max length of uint32_t is 10 digits
+    uint32_t tx_time = Clock::micros();
+    line[line_length < PING_TOKEN_MAX ? line_length : PING_TOKEN_MAX] = '\0';
+    serial.sendChar('p');
+    serial.sendString(line);
+    serial.sendChar(',');
+    ultoa(rx_time, buffer, 10);
+    serial.sendString(buffer);
+    serial.sendChar(',');
+    ultoa(tx_time, buffer, 10);
+    serial.sendString(buffer);
+    serial.sendChar('\n');
+}
+
+/**
+ * @brief Function to select the input source
+ * 
+ * @details This function parses "<source>[,<low>[,<high>[,<period>[,<seed>]]]]",
+ * selects the source and reports the selection. Missing values take their defaults.
+ */
+static void select_signal()
+{
+    uint16_t values[4] = {0, SIGNAL_MAX, 0, 0};
+    uint8_t count = 0;
+    line[line_length] = '\0';
+    for (char *p = line + 1; *p == ',' && count < 4; ++count)
+    {
+        values[count] = (uint16_t)strtoul(p + 1, &p, 10);
+    }
+    signal_gen.select((SignalShape)(line[0] - '0'), values[0], values[1], values[2], values[3]);
+    signal_gen.report(serial);
+}
+
+/**
+ * @brief Function to render the volume on the display
+ * 
+ * @details This function encodes the volume step of the value into the shown
+ * frame, the mapped value with a volume curve selected and the linear volume
+ * otherwise, so the display shows 0-100 in both report formats. The frame is
+ * printed by the main loop unless the device is muted, and the cached frame
+ * restores the newest value on unmute. An unchanged frame is not sent again
+ * and nothing changes while a host line overrides the display.
+ * 
+ * @param value Filtered value from 0 to 1023
+ */
+static void render_local(uint16_t value)
+{
+    if (local_override)
     {
-        if ((serial.available()) && (serial.readChar() == 'w'))
+        return;
+    }
+    uint8_t step = serial.hasCurve() ? (uint8_t)serial.mapValue(value) : VolumeCurve::map(VolumeCurve::table(CURVE_LINEAR), value);
+    char buffer[4]; // Max volume step has 3 digits
+    utoa(step, buffer, 10);
+    uint8_t frame[DISPLAY_DIGITS] = {0};
+    for (char *p = buffer; *p; ++p)
+    {
+        display.pushDigit(frame, *p);
+    }
+    // Reports of the same volume step do not resend the frame
+    for (uint8_t i = 0; i < DISPLAY_DIGITS; ++i)
+    {
+        if (frames[shown_frame][i] != frame[i])
         {
-            serial.sendChar('w');
-            welcome = 1;
+            frames[shown_frame][i] = frame[i];
+            display_change = 1;
         }
-    } while (welcome == 0);
+    }
+}
+
+/**
+ * @brief Function to run the microbenchmarks
+ * 
+ * @details This function times a fixed set of cases in CPU cycles and sends
+ * "b<FOSC>,<overhead>\n", one "b<case><parameter>,<runs>,<min>,<max>\n" line per
+ * case and "be\n": the median filter sort over 5, 11 and MEDIAN_FILTER_SIZE
+ * samples (m), the formatting of a 4 and a 10 digit number (n), 16 push/pop
+ * pairs of a queue (q), one display frame (d) and the body of the ADC interrupt
+ * with the selected input source (a, without the vector prologue and epilogue,
+ * so interrupts stay off while it is timed). The ADC interrupt is disabled meanwhile, the
+ * samples of the ADC case are discarded without counting them as lost, a sample
+ * posted before is kept and the signal generator is restored. The command is
+ * refused during a capture, so the ADC case never feeds the capture buffers.
+ */
+static void run_benchmarks()
+{
+    static volatile uint64_t sink; // Keeps the optimizer from dropping the cases
+    char buffer[11]; // Max length of uint32_t is 10 digits
+    uint8_t adc_interrupt = ADCSRA & (1 << ADIE);
+    ADCSRA &= ~(1 << ADIE);
+    // The frame of the display case must be the only one on the bus
+    display_bus.flush();
+    MicroBench::begin();
+
+    serial.sendChar('b');
+    ultoa(FOSC, buffer, 10);
+    serial.sendString(buffer);
+    serial.sendChar(',');
+    utoa(MicroBench::overheadCycles(), buffer, 10);
+    serial.sendString(buffer);
+    serial.sendChar('\n');
 
-    // Wait for first ADC value
-    do
+    static const uint8_t windows[] = {5, 11, MEDIAN_FILTER_SIZE};
+    for (uint8_t window : windows)
     {
-        if (new_adc_val)
+        MicroBench::Result r = MicroBench::measure(BENCH_RUNS, [window] { sink = serial.median(window); });
+        MicroBench::report(serial, 'm', window, BENCH_RUNS, r);
+    }
+
+    MicroBench::Result r = MicroBench::measure(BENCH_RUNS, [&buffer] { utoa(1023, buffer, 10); });
+    MicroBench::report(serial, 'n', 4, BENCH_RUNS, r);
+    r = MicroBench::measure(BENCH_RUNS, [&buffer] { ultoa(4294967295UL, buffer, 10); });
+    MicroBench::report(serial, 'n', 10, BENCH_RUNS, r);
+
+    struct TQueue queue;
+    queue_init(&queue);
+    r = MicroBench::measure(BENCH_RUNS, [&queue] {
+        for (uint8_t i = 0; i < 16; ++i)
         {
-            new_adc_val = 0;
-            if (check_range_val(adc_val))
-            {
-                serial.sendMedianFilter(adc_val);
-                welcome = 0;
-            }
+            queue_push(&queue, i);
+            queue_pop(&queue);
+        }
+    });
+    MicroBench::report(serial, 'q', 16, BENCH_RUNS, r);
+    sink = queue.iPopPos;
+
+    r = MicroBench::measure(BENCH_DISPLAY_RUNS, [] {
+        if (is_muted)
+        {
+            display.printMute();
+        }
+        else
+        {
+            display.printFrame(frames[shown_frame]);
         }
-    } while (welcome == 1);
+        display_bus.flush();
+    });
+    MicroBench::report(serial, 'd', DISPLAY_DIGITS, BENCH_DISPLAY_RUNS, r);
 
-    char display_change = 0;
-    int end_byte_pos = -1;
-    char buffer[4] = {'\0', '\0', '\0', '\0'};
+    // The ADC case must not change the input of the firmware: the generator
+    // continues where it was and the benchmark samples are not lost
+    uint16_t pending = 0;
+    char has_pending = adc_mailbox.take(pending);
+    SignalGen generator;
+    if constexpr (Features::signal_gen)
+    {
+        generator = signal_gen;
+    }
+    r = MicroBench::measure(BENCH_RUNS, [] { adc_sample(); });
+    MicroBench::report(serial, 'a', Features::signal_gen ? signal_gen.source() : SIGNAL_ADC, BENCH_RUNS, r);
+    if constexpr (Features::signal_gen)
+    {
+        signal_gen = generator;
+    }
+    adc_mailbox.discard();
+    if (has_pending)
+    {
+        adc_mailbox.post(pending);
+    }
 
-    char last_display_val[4] = {'\0', '\0', '\0', '\0'};
-    char last_end_byte_pos = -1;
+    (void)sink;
+    MicroBench::end();
+    ADCSRA |= adc_interrupt;
+    serial.sendChar('b');
+    serial.sendChar('e');
+    serial.sendChar('\n');
+}
 
-    // Main loop
-    MUTE_Init();
-    sei();
-    while (1)
+/**
+ * @brief Function to resume the session of a reconnected host
+ * 
+ * @details This function returns the command parser and the display line to
+ * their idle state, stops a capture and selects the bare report format. It
+ * flushes the state of the previous host: the key events queued for it, the ADC
+ * sample not yet taken by the main loop and the flow state, which is sent again
+ * as the new host may have missed it. The bytes the host sent after the CAN byte stay queued.
+ * The median filter window, the volume curve, the display frame, the sampling
+ * rate, the mute state and the sequence numbers are kept. It sends "s1\n" and
+ * one report of the last filtered value (0 while muted), so the host has the
+ * current volume without a handshake or a cold start.
+ */
+static void resume_session()
+{
+    if (Features::capture && capture.isActive())
+    {
+        capture.stop(serial);
+    }
+    line_command = 0;
+    line_length = 0;
+    uint8_t *rx_frame = frames[shown_frame ^ 1];
+    for (uint8_t i = 0; i < DISPLAY_DIGITS; ++i)
+    {
+        rx_frame[i] = 0;
+    }
+    rx_digits = 0;
+    rx_valid = 1;
+    if constexpr (Features::keys)
+    {
+        keys.flush();
+    }
+    uint8_t sreg = SREG;
+    cli();
+    adc_mailbox.discard();
+    SREG = sreg;
+    serial.resumeFlow();
+    serial.setStamped(0);
+    serial.sendChar('s');
+    serial.sendChar('1');
+    serial.sendChar('\n');
+    serial.sendReport(is_muted ? 0 : serial.mapValue(serial.lastSent()));
+}
+
+/**
+ * @brief Function to run the profiler command
+ * 
+ * @details An empty line reports the histogram, "<from>,<to>" with byte addresses
+ * restarts the profiler over that flash range and reports the empty histogram.
+ */
+static void profiler_command()
+{
+    if (line_length)
     {
-        if (!unmute_handled)
+        char *p;
+        line[line_length] = '\0';
+        uint16_t from = (uint16_t)strtoul(line, &p, 10);
+        uint16_t to = (*p == ',') ? (uint16_t)strtoul(p + 1, NULL, 10) : 0;
+        Profiler::start(from, to);
+    }
+    Profiler::report(serial);
+}
+
+/**
+ * @brief Function to handle a byte received from the host
+ * 
+ * @details This function handles the resume, reset, memory, capture, timestamp, ping, filter, signal,
+ * local display, benchmark, noise tuning and profiler commands and encodes digits of the value to display into the back frame. A complete line
+ * of valid digits replaces the shown frame, in the local display mode for DISPLAY_OVERRIDE_US.
+ * 
+ * @param data Received byte
+ */
+static void handle_rx(char data)
+{
+    uint8_t *rx_frame = frames[shown_frame ^ 1];
+    if (data == RESUME_BYTE)
+    {
+        // Resume from any parser state, also inside a command line
+        resume_session();
+        return;
+    }
+    if (line_command)
+    {
+        // Collect the arguments, the display frame is not touched
+        if (data == '\n')
         {
-            serial.sendNum(adc_val);
-            serial.sendChar('\n');
-            display.printNumChar(last_display_val, last_end_byte_pos);
-            for (int i = last_end_byte_pos; i >= 0; --i)
+            if (Features::diagnostics && line_command == 'p')
+            {
+                answer_ping(Clock::micros());
+            }
+            else if (Features::profiling && line_command == 'h')
+            {
+                profiler_command();
+            }
+            else if (Features::signal_gen && line_command == 'g')
             {
-                last_display_val[i] = '\0';
+                select_signal();
             }
-            last_end_byte_pos = -1;
-            unmute_handled = 1;
+            line_command = 0;
         }
-        if (is_muted && !mute_handled)
+        else if (line_length < COMMAND_LINE_MAX)
         {
-            serial.sendNum(0);
-            serial.sendChar('\n');
-            display.printMute();
-            mute_handled = 1;
+            line[line_length++] = data;
         }
-        if (display_change && !is_muted)
+        return;
+    }
+    if ((Features::diagnostics && data == 'p') || (Features::signal_gen && data == 'g') || (Features::profiling && data == 'h'))
+    {
+        // Start a ping, a source selection or a profiler command, the arguments follow until the end of the line
+        line_command = data;
+        line_length = 0;
+        return;
+    }
+    if (Features::stamps && data == 't')
+    {
+        // Toggle the stamped report format
+        serial.setStamped(!serial.isStamped());
+        serial.sendChar('t');
+        serial.sendChar(serial.isStamped() ? '1' : '0');
+        serial.sendChar('\n');
+        return;
+    }
+    if (Features::step_tracking && data == 'f')
+    {
+        // Toggle the step tracking mode of the median filter
+        serial.setStepTracking(!serial.isStepTracking());
+        serial.sendChar('f');
+        serial.sendChar(serial.isStepTracking() ? '1' : '0');
+        serial.sendChar('\n');
+        return;
+    }
+    if (Features::local_display && data == 'l')
+    {
+        // Toggle the local display mode
+        local_display = !local_display;
+        local_override = 0;
+        if (local_display)
         {
-            display.printNumChar(buffer, end_byte_pos);
-            for (int i = end_byte_pos; i >= 0; --i)
+            render_local((uint16_t)serial.lastSent());
+        }
+        serial.sendChar('l');
+        serial.sendChar(local_display ? '1' : '0');
+        serial.sendChar('\n');
+        return;
+    }
+    if (data == 'r')
+    {
+        // Reset the system by entering an infinite loop, allowing the watchdog timer to trigger a reset
+        display.printNum(69);
+        display_bus.flush();
+        wdt_reset();
+        wdt_enable(WDTO_15MS);
+        while (1) {}
+    }
+    if (Features::bench && data == 'b' && !(Features::capture && capture.isActive()))
+    {
+        // Run the microbenchmarks
+        run_benchmarks();
+        return;
+    }
+    if (Features::noise_tuning && data == 'n')
+    {
+        // Report the tuned filter
+        tuner.report(serial);
+        return;
+    }
+    if (Features::diagnostics && data == 'm')
+    {
+        // Report the RAM budget
+        MemMonitor::report(serial);
+        return;
+    }
+    if (Features::capture && data == 'c')
+    {
+        // Toggle the raw ADC capture mode
+        if (capture.isActive())
+        {
+            capture.stop(serial);
+        }
+        else
+        {
+            // The free running mode of the capture needs the auto trigger
+            stable_samples = 0;
+            set_idle_sampling(0);
+            capture.start(serial, LINE_BAUDRATE);
+        }
+        return;
+    }
+    if (data == '\n')
+    {
+        // Only a complete line of valid digits replaces the shown frame
+        if (rx_valid)
+        {
+            shown_frame ^= 1;
+            display_change = 1;
+            if (Features::local_display && local_display)
             {
-                buffer[i] = '\0';
+                local_override = 1;
+                override_until = Clock::micros() + DISPLAY_OVERRIDE_US;
             }
-            end_byte_pos = -1;
-            display_change = 0;
         }
-        if (new_adc_val && !is_muted)
+        rx_frame = frames[shown_frame ^ 1];
+        for (uint8_t i = 0; i < DISPLAY_DIGITS; ++i)
+        {
+            rx_frame[i] = 0;
+        }
+        rx_digits = 0;
+        rx_valid = 1;
+    }
+    else if (rx_valid)
+    {
+        // Reject the line on an invalid character or too many digits
+        if (rx_digits < NUM_DIGITS && display.pushDigit(rx_frame, data))
+        {
+            rx_digits++;
+        }
+        else
+        {
+            rx_valid = 0;
+        }
+    }
+}
+
+/**
+ * @brief Function to adapt the sampling rate to the signal activity
+ * 
+ * @details This function switches to the idle rate, one conversion every
+ * IDLE_SAMPLE_US started by the main loop, after IDLE_AFTER_SAMPLES samples
+ * without a report, and back to the Timer0 rate as soon as a value is sent or a
+ * sample differs from the last sent value by more than ACTIVITY_DEADBAND. A move
+ * of a still knob is therefore seen within one IDLE_SAMPLE_US. Timer0 keeps the
+ * sampling period, so the median window spans the same time whenever the knob
+ * moves. The window is not flushed on a change: the idle rate is only entered
+ * once the window is stable, so the older idle samples equal the current value.
+ * 
+ * @param value Last ADC value
+ * @param sent 1 if the value led to a report
+ */
+static void adapt_sample_period(uint16_t value, char sent)
+{
+    uint16_t last = (uint16_t)serial.lastSent();
+    uint16_t difference = (value > last) ? value - last : last - value;
+    if (sent || difference > ACTIVITY_DEADBAND)
+    {
+        if (stable_samples >= IDLE_AFTER_SAMPLES)
         {
-            new_adc_val = 0;
-            serial.sendMedianFilter(adc_val);
+            set_idle_sampling(0);
         }
+        stable_samples = 0;
+    }
+    else if (stable_samples < IDLE_AFTER_SAMPLES)
+    {
+        if (++stable_samples == IDLE_AFTER_SAMPLES)
+        {
+            set_idle_sampling(1);
+        }
+    }
+}
+
+// Function to run one iteration of the main loop
+void firmware_poll()
+{
+    uint16_t value;
+    char muted;
+    KeyEvent key;
+
+    // Send the next step of queued display frames
+    display_bus.poll();
+
+    switch (main_state)
+    {
+    case STATE_HANDSHAKE:
+        // Handshake with serial communication, "w" for raw values or "v<curve>" for volume steps
         if (serial.available())
         {
-            if (end_byte_pos == 3)
+            char data = serial.readChar();
+            if (data == RESUME_BYTE)
+            {
+                // No session to resume, the host has to send the handshake
+                curve_handshake = 0;
+                serial.sendChar('s');
+                serial.sendChar('0');
+                serial.sendChar('\n');
+            }
+            else if (Features::curves && curve_handshake)
+            {
+                curve_handshake = 0;
+                const uint8_t *table = (data >= '0') ? VolumeCurve::table(data - '0') : nullptr;
+                if (table)
+                {
+                    serial.setCurve(table);
+                    serial.sendChar('v');
+                    serial.sendChar(data);
+                    serial.sendChar('\n');
+                    main_state = STATE_FIRST_VALUE;
+                }
+            }
+            else if (data == 'w')
+            {
+                serial.sendChar('w');
+                main_state = STATE_FIRST_VALUE;
+            }
+            else if (Features::curves && data == 'v')
+            {
+                curve_handshake = 1;
+            }
+        }
+        break;
+
+    case STATE_FIRST_VALUE:
+        // Wait for first ADC value
+        if (adc_mailbox.take(value))
+        {
+            if (check_range_val(value))
+            {
+                serial.sendMedianFilter(value);
+                if (Features::local_display && local_display)
+                {
+                    render_local(value);
+                }
+                MUTE_Init();
+                sei();
+                main_state = STATE_RUNNING;
+            }
+        }
+        break;
+
+    case STATE_RUNNING:
+        if (Features::capture && capture.isActive())
+        {
+            // Only block frames are sent in capture mode
+            capture.service(serial);
+            if (serial.available())
             {
-                end_byte_pos = -1;
+                handle_rx(serial.readChar());
             }
-            end_byte_pos++;
-            buffer[end_byte_pos] = serial.readChar();
-            if (buffer[end_byte_pos] == 'r')
+            break;
+        }
+        if (mute_mailbox.take(muted) && muted != is_muted)
+        {
+            is_muted = muted;
+            if (is_muted)
             {
-                // Reset the system by entering an infinite loop, allowing the watchdog timer to trigger a reset
-                display.printNum(69);
-                wdt_reset();
-                wdt_enable(WDTO_15MS);
-                while (1) {}
+                serial.sendReport(0);
+                display.printMute();
             }
-            if (buffer[end_byte_pos] == '\n')
+            else
             {
-                display_change = 1;
-                for (int i = end_byte_pos; i >= 0; --i)
+                // The filtered value, a raw sample could disagree with the next median
+                serial.sendReport(serial.mapValue(serial.lastSent()));
+                if (Features::local_display && local_display)
                 {
-                    last_display_val[i] = buffer[i];
+                    render_local((uint16_t)serial.lastSent());
                 }
-                last_end_byte_pos = end_byte_pos;
+                // Restore the cached frame, it already contains the newest value
+                display.printFrame(frames[shown_frame]);
+                display_change = 0;
+            }
+        }
+        if (Features::local_display && local_override && (int32_t)(Clock::micros() - override_until) >= 0)
+        {
+            // The override ended, show the volume again
+            local_override = 0;
+            render_local((uint16_t)serial.lastSent());
+        }
+        if (display_change && !is_muted)
+        {
+            display.printFrame(frames[shown_frame]);
+            display_change = 0;
+        }
+        if (idle_sampling && (int32_t)(Clock::micros() - next_idle_sample) >= 0)
+        {
+            // Start the single conversion of the idle rate
+            next_idle_sample = Clock::micros() + IDLE_SAMPLE_US;
+            ADCSRA |= (1 << ADSC);
+        }
+        if (adc_mailbox.take(value) && !is_muted)
+        {
+            char sent = serial.sendMedianFilter(value);
+            adapt_sample_period(value, sent);
+            if (Features::noise_tuning && tuner.sample(value))
+            {
+                serial.setFilter(tuner.filterWindow(), tuner.sendingBias());
+                tuner.report(serial);
+            }
+            if (sent && Features::local_display && local_display)
+            {
+                render_local((uint16_t)serial.lastSent());
             }
         }
+        else if (Features::keys && keys.take(key))
+        {
+            // Keys only use iterations without a sample, one event at a time
+            Keys::send(serial, key);
+        }
+        if (serial.available())
+        {
+            handle_rx(serial.readChar());
+        }
+        break;
+    }
+}
+
+#ifndef HOST_BUILD
+/**
+ * @brief Main function
+ * 
+ * @details This is the main function of the program. It initializes the
+ * firmware and then runs the main loop, which performs a handshake with serial
+ * communication, waits for the first ADC value and then handles mute/unmute
+ * functionality, ADC value processing, and serial communication.
+ * 
+ * @return int 
+ */
+int main(void)
+{
+    firmware_init();
+    while (1)
+    {
+        firmware_poll();
     }
-}
\ No newline at end of file
+}
+#endif